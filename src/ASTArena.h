@@ -0,0 +1,112 @@
+//
+// Arena allocation for the abstract syntax tree.
+//
+// The parser builds a very large number of small nodes (every binary
+// operator alone is a Call, an Ident and an Actuals), and all of them
+// live exactly as long as the tree does.  Instead of a malloc per node,
+// we carve nodes out of large chunks, keep them next to each other in
+// memory, and release the whole tree at once when the arena goes away.
+// The Driver owns the arena, so the tree lives as long as the Driver.
+//
+
+#ifndef ASTARENA_H
+#define ASTARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AST {
+
+    class Arena {
+        // Most programs fit in a handful of chunks of this size
+        static const size_t CHUNK_SIZE = 64 * 1024;
+
+        // Nodes holding strings or vectors must have their destructors
+        // run before the chunk underneath them is released.
+        struct Finalizer {
+            void (*destroy)(void *);
+            void *obj;
+        };
+
+        std::vector<char *> chunks_;
+        std::vector<Finalizer> finalizers_;
+        char *cur_ = nullptr;  // Next free byte in the current chunk
+        size_t left_ = 0;      // Bytes remaining in the current chunk
+
+        template<class T>
+        static void destroy(void *obj) { static_cast<T *>(obj)->~T(); }
+
+        char *new_chunk(size_t size) {
+            char *chunk = static_cast<char *>(std::malloc(size));
+            if (chunk == nullptr) {
+                throw std::bad_alloc();
+            }
+            chunks_.push_back(chunk);
+            ++chunks_allocated;
+            return chunk;
+        }
+
+    public:
+        // Counters, so we can see how much the parse actually allocated
+        size_t nodes_allocated = 0;   // Objects constructed in the arena
+        size_t bytes_allocated = 0;   // Bytes handed out (including padding)
+        size_t chunks_allocated = 0;  // Calls to malloc
+
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        ~Arena() {
+            // Reverse order, so children are destroyed after parents
+            for (auto it = finalizers_.rbegin(); it != finalizers_.rend(); ++it) {
+                it->destroy(it->obj);
+            }
+            for (char *chunk : chunks_) {
+                std::free(chunk);
+            }
+        }
+
+        /* Raw, suitably aligned memory.  Requests too large for a
+         * chunk get a chunk of their own, and do not disturb the
+         * chunk we are currently filling.
+         */
+        void *allocate(size_t size, size_t align) {
+            size_t pad = (align - reinterpret_cast<size_t>(cur_) % align) % align;
+            if (pad + size > left_) {
+                if (size > CHUNK_SIZE / 4) {
+                    bytes_allocated += size;
+                    return new_chunk(size);
+                }
+                cur_ = new_chunk(CHUNK_SIZE);
+                left_ = CHUNK_SIZE;
+                pad = 0;   // malloc already gives us maximal alignment
+            }
+            char *mem = cur_ + pad;
+            cur_ += pad + size;
+            left_ -= pad + size;
+            bytes_allocated += pad + size;
+            return mem;
+        }
+
+        /* Construct a node (or any other object) in the arena, e.g.,
+         *    arena.make<AST::Ident>("x")
+         */
+        template<class T, class... Args>
+        T *make(Args&&... args) {
+            void *mem = allocate(sizeof(T), alignof(T));
+            T *obj = new (mem) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value) {
+                finalizers_.push_back(Finalizer{destroy<T>, obj});
+            }
+            ++nodes_allocated;
+            return obj;
+        }
+    };
+
+}
+
+#endif //ASTARENA_H
@@ -2,6 +2,8 @@
 // Created by Michal Young on 9/12/18.
 //
 
+#include <climits>
+#include <cstdio>
 #include "ASTNode.h"
 #include "staticsemantics.cpp"
 
@@ -139,7 +141,7 @@ namespace AST {
 
     void Ident::json(std::ostream& out, AST_print_context& ctx) {
         json_head("Ident", out, ctx);
-        out << "\"text_\" : \"" << text_ << "\"";
+        out << "\"text_\" : \"" << sym_ << "\"";
         json_close(out, ctx);
     }
 
@@ -203,27 +205,25 @@ namespace AST {
 
 
     /* Convenience factory for operations like +, -, *, / */
-    Call* Call::binop(std::string opname, Expr& receiver, Expr& arg) {
-        Ident* method = new Ident(opname);
-        Actuals* actuals = new Actuals();
+    Call* Call::binop(Arena& arena, Symbol opname, Expr& receiver, Expr& arg) {
+        Ident* method = arena.make<Ident>(opname);
+        Actuals* actuals = arena.make<Actuals>();
         actuals->append(&arg);
-        return new Call(receiver, *method, *actuals);
+        return arena.make<Call>(receiver, *method, *actuals);
     }
 
     /* IMPLEMENT ALL THE TYPE INITIALIZATION METHODS */
-    int Stub::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Stub::init_check(StaticSemantics *ss, ScopedSet *vars) {
         return 0;
     }
 
     //template<>
-    //int Seq<ASTNode>::init_check(StaticSemantics *ss, std::set<std::string> *vars) {}
+    //int Seq<ASTNode>::init_check(StaticSemantics *ss, ScopedSet *vars) {}
 
-    int Program::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Program::init_check(StaticSemantics *ss, ScopedSet *vars) {
         // check initialization for each class in classes
-        AST::Classes classes = this->classes_;
-        vector < AST::Class * > class_list = classes.elements_;
-        for (AST::Class *clazz: class_list) {
-            std::cout << "Init Checking Class: " << clazz->name_.str() << endl;
+        for (AST::Class *clazz: this->classes_) {
+            std::cout << "Init Checking Class: " << clazz->name_.get_text() << endl;
             int class_result = clazz->init_check(ss, vars);
             if (!class_result) {
                 return 0;
@@ -232,9 +232,7 @@ namespace AST {
         // bus error happening sometime above this
         //exit(1);
         // check each statement in the statement block that comes after the classes
-        AST::Block statements = this->statements_;
-        vector < AST::ASTNode * > statement_list =  statements.elements_;
-        for (AST::ASTNode *stmt: statement_list) {
+        for (AST::ASTNode *stmt: this->statements_) {
             std::cout << "Init Checking Statement: " << stmt->str() << endl;
             int stmt_result = stmt->init_check(ss, vars);
             if (!stmt_result) {
@@ -244,19 +242,18 @@ namespace AST {
         return 1;
     }
 
-    int Formal::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Formal::init_check(StaticSemantics *ss, ScopedSet *vars) {
         // TODO don't add here? only add when I know it was a fully successful method?
-        Ident formal_arg = this->var_;
-        string arg = formal_arg.text_;
+        Symbol arg = this->var_.sym_;
         std::cout << "Inserting formal arg: " << arg << endl;
         vars->insert(arg);
         return 1;
     }
 
-    int Method::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Method::init_check(StaticSemantics *ss, ScopedSet *vars) {
         // init check formal args - add
-        //std::set<std::string>* method_args = new std::set<std::string>(*vars);
-        for (Formal* fml : this->formals_.elements_) {
+        //std::set<Symbol>* method_args = new std::set<Symbol>(*vars);
+        for (Formal* fml : this->formals_) {
             int fml_result = fml->init_check(ss, vars);
             if (!fml_result) {
                 std::cout << "Method Checking Results: Formal Arg Result: " << fml_result <<endl;
@@ -264,9 +261,7 @@ namespace AST {
             }
         }
         // init check method body
-        AST::Block statements = this->statements_;
-        vector < AST::ASTNode * > statement_list =  statements.elements_;
-        for (AST::ASTNode *stmt: statement_list) {
+        for (AST::ASTNode *stmt: this->statements_) {
             int stmt_result = stmt->init_check(ss, vars);
             if (!stmt_result) {
                 std::cout << "Method Checking Results: Statement Result: " << stmt_result<<endl;
@@ -280,106 +275,123 @@ namespace AST {
             return 0;
         }
         // add method name to the table if all was successful
-        vars->insert(this->name_.text_);
+        vars->insert(this->name_.sym_);
         return 1;
 
     }
     /*  statement: l_expr '=' expr ';'
     { $$ = new AST::Assign(*$1, *$3); };*/
-    int Assign::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        //std::set<std::string>* temp_args = new std::set<std::string>(*vars);
+    int Assign::init_check(StaticSemantics *ss, ScopedSet *vars) {
+        //std::set<Symbol>* temp_args = new std::set<Symbol>(*vars);
         int r_result = this->rexpr_.init_check(ss, vars);
         if (!r_result) {
             std::cout<< "Error in Assign Right Part" <<endl;
             return 0;
         }
-        std::string var_name = this->lexpr_.get_text();
+        Symbol var_name = this->lexpr_.get_sym();
         vars->insert(var_name);
         return 1;
     }
     /*statement: l_expr ':' ident '=' expr ';'
     {$$ = new AST::AssignDeclare(*$1, *$5, *$3);};*/
-    int AssignDeclare::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        //std::set<std::string>* temp_args = new std::set<std::string>(*vars);
+    int AssignDeclare::init_check(StaticSemantics *ss, ScopedSet *vars) {
+        //std::set<Symbol>* temp_args = new std::set<Symbol>(*vars);
         int r_result = this->rexpr_.init_check(ss, vars);
         if (!r_result) {
             std::cout<< "Error in AssignDeclare Right Part" <<endl;
             return 0;
         }
-        std::string var_name = this->lexpr_.get_text();
+        Symbol var_name = this->lexpr_.get_sym();
         vars->insert(var_name);
         return 1;
     }
 
-    int Return::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Return::init_check(StaticSemantics *ss, ScopedSet *vars) {
         std::cout<< "Return Statement Expr: " <<expr_.str()<<endl;
         int result = this->expr_.init_check(ss, vars);
         return result;
     }
 
-    int If::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int If::init_check(StaticSemantics *ss, ScopedSet *vars) {
         if (!(this->cond_.init_check(ss, vars))){
             std::cout << "Error in If Statement Conditional Part: " << cond_.str()<<endl;
             return 0;
         }
-        std::set<std::string>* true_args = new std::set<std::string>(*vars);
-        // true and false are seqs of ASTNodes
-        //AST::Block statements = this->statements_;
-        vector < AST::ASTNode * > true_list =  this->truepart_.elements_;
-        for (AST::ASTNode *true_item: true_list) {
-            int result = true_item->init_check(ss, true_args);
+        // true and false are seqs of ASTNodes, each checked in its own scope
+        // (on an error we give up on the whole check, so scopes are left open)
+        vars->push();
+        for (AST::ASTNode *true_item: this->truepart_) {
+            int result = true_item->init_check(ss, vars);
             if (!result) {
                 std::cout << "Error in If Statement True Part: " << true_item->str()<<endl;
                 return 0;
             }
         }
-        std::set<std::string>* false_args = new std::set<std::string>(*vars);
-        vector < AST::ASTNode * > false_list =  this->falsepart_.elements_;
-        for (AST::ASTNode *false_item: false_list) {
-            int result = false_item->init_check(ss, false_args);
+        std::vector<Symbol> true_added = vars->pop();
+        vars->push();
+        for (AST::ASTNode *false_item: this->falsepart_) {
+            int result = false_item->init_check(ss, vars);
             if (!result) {
                 std::cout << "Error in If Statement False Part: " << false_item->str()<<endl;
                 return 0;
             }
         }
-        //exit(1);
+        std::vector<Symbol> false_added = vars->pop();
         // add the intersecting variables of true and false parts if every section type init OK
-        for (std::string var : *true_args) {
-            if ((false_args->find(var)) != false_args->end()) {
+        std::set<Symbol> in_false(false_added.begin(), false_added.end());
+        for (Symbol var : true_added) {
+            if (in_false.count(var)) {
                 vars->insert(var);
             }
         }
         return 1;
     }
 
-    int While::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int While::init_check(StaticSemantics *ss, ScopedSet *vars) {
         // type check the condition and the statements, don't update the vars table
         if (!(this->cond_.init_check(ss, vars))){
             return 0;
         }
-        std::set<std::string>* temp_vars = new std::set<std::string>(*vars);
-        vector < AST::ASTNode * > body_list =  this->body_.elements_;
-        for (AST::ASTNode *body_item: body_list) {
-            int result = body_item->init_check(ss, temp_vars);
+        vars->push();
+        for (AST::ASTNode *body_item: this->body_) {
+            int result = body_item->init_check(ss, vars);
             if (!result) {
                 std::cout << "Error in While Statement Body: " << result<<endl;
                 return 0;
             }
         }
+        vars->pop();
         return 1;
     }
 
-    int Typecase::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        //TODO something here?
+    int Typecase::init_check(StaticSemantics *ss, ScopedSet *vars) {
+        if (!(this->expr_.init_check(ss, vars))) {
+            std::cout << "Error in Typecase Expression: " << expr_.str()<<endl;
+            return 0;
+        }
+        // each alternative in its own scope, nothing it initializes is kept
+        for (Type_Alternative *alt : this->cases_) {
+            vars->push();
+            if (!alt->init_check(ss, vars)) {
+                return 0;
+            }
+            vars->pop();
+        }
         return 1;
     }
 
-    int Type_Alternative::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        //TODO something here?
+    int Type_Alternative::init_check(StaticSemantics *ss, ScopedSet *vars) {
+        vars->insert(this->ident_.sym_);
+        for (AST::ASTNode *stmt: this->block_) {
+            if (!stmt->init_check(ss, vars)) {
+                std::cout << "Error in Typecase Alternative: " << stmt->str()<<endl;
+                return 0;
+            }
+        }
         return 1;
     }
 
-    int Load::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Load::init_check(StaticSemantics *ss, ScopedSet *vars) {
         //TODO add variable to the table
         std::cout << "Load loc: " << this->loc_.str() <<endl;
         return this->loc_.init_check(ss, vars);
@@ -389,57 +401,56 @@ namespace AST {
         return this->loc_.get_text();
     }
 
-    int Ident::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        if ((vars->find(this->text_)) != vars->end()) {
+    int Ident::init_check(StaticSemantics *ss, ScopedSet *vars) {
+        if (vars->contains(this->sym_)) {
             return 1;
         } else {
-            std::cout << "ERROR Using Uninitialized Variable: " << this->text_ << endl;
+            std::cout << "ERROR Using Uninitialized Variable: " << this->sym_ << endl;
             return 0;
         }
     }
 
     std::string Ident::get_text() {
-        return this->text_;
+        return this->sym_.str();
     }
 
-    int Class::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Class::init_check(StaticSemantics *ss, ScopedSet *vars) {
         // check that the constructor initializes all class level vars (like any normal method)
-        //std::set<std::string>* class_args = new std::set<std::string>(*vars);
-        vars->insert(this->name_.text_);
+        //std::set<Symbol>* class_args = new std::set<Symbol>(*vars);
+        vars->insert(this->name_.sym_);
         int const_result = this->constructor_.init_check(ss, vars);
         if (!const_result) {
-            std::cout << "Error Init Checking Class Constructor: " << this->name_.text_<<endl;
+            std::cout << "Error Init Checking Class Constructor: " << this->name_.sym_<<endl;
             return 0;
         }
         // anything inherited from the superclass needs to have been initialized
-        ClassNode superclass = ss->class_hierarchy[this->super_.str()];
-        std::map<string, string> super_vars = superclass.instance_vars;
-        for (std::pair<std::string, string> element : super_vars) {
-            if ((vars->find(element.first)) == vars->end()){
-                return 0; // something wasn't initialized
+        const ClassNode* superclass = ss->find_class(this->super_.sym_);
+        if (superclass != nullptr) {
+            for (const std::pair<const Symbol, TypeId> &element : superclass->instance_vars) {
+                if (!vars->contains(element.first)) {
+                    return 0; // something wasn't initialized
+                }
             }
         }
         // now check all the methods
-        vector < AST::Method * > method_list = this->methods_.elements_;
-        for (AST::Method *method: method_list) {
-            std::cout << "Init Checking Method: " << method->name_.text_;
-            std::set<std::string>* method_args = new std::set<std::string>(*vars);
-            if (!method->init_check(ss, method_args)){
+        for (AST::Method *method: this->methods_) {
+            std::cout << "Init Checking Method: " << method->name_.sym_;
+            vars->push();
+            if (!method->init_check(ss, vars)){
                 return 0;
             }
-            vars->insert(method->name_.text_);
+            vars->pop();
+            vars->insert(method->name_.sym_);
         }
         // if everything goes well add the class name to the var table
-//        vars->insert(this->name_.text_);
+//        vars->insert(this->name_.sym_);
         return 1;
     }
 
-    int Call::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        if ((vars->find(this->method_.text_)) != vars->end()) {
+    int Call::init_check(StaticSemantics *ss, ScopedSet *vars) {
+        if (vars->contains(this->method_.sym_)) {
             // method was initialized! now check the args
-            Actuals actual_args = this->actuals_;
-            vector < Expr * > arg_list = actual_args.elements_;
-            for (Expr* arg : arg_list) {
+            for (Expr* arg : this->actuals_) {
                 if (!arg->init_check(ss, vars)) {
                     std::cout << "Actual argument not found: " << arg->str()<<endl;
                     return 0;
@@ -455,13 +466,11 @@ namespace AST {
         }
     }
 
-    int Construct::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Construct::init_check(StaticSemantics *ss, ScopedSet *vars) {
         // make sure that class type has been added to the scope
-        if ((vars->find(this->method_.text_) != vars->end())) {
+        if (vars->contains(this->method_.sym_)) {
             // then make sure the passed args were initialized
-            Actuals actual_args = this->actuals_;
-            vector < Expr * > arg_list = actual_args.elements_;
-            for (Expr* arg : arg_list) {
+            for (Expr* arg : this->actuals_) {
                 if (!arg->init_check(ss, vars)) {
                     return 0;
                 }
@@ -471,15 +480,15 @@ namespace AST {
         return 0;
     }
 
-    int IntConst::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int IntConst::init_check(StaticSemantics *ss, ScopedSet *vars) {
         return 1;
     }
 
-    int StrConst::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int StrConst::init_check(StaticSemantics *ss, ScopedSet *vars) {
         return 1;
     }
 
-    int And::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int And::init_check(StaticSemantics *ss, ScopedSet *vars) {
         int right_result = this->right_.init_check(ss, vars);
         int left_result = this->left_.init_check(ss, vars);
 
@@ -490,7 +499,7 @@ namespace AST {
         }
     }
 
-    int Or::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Or::init_check(StaticSemantics *ss, ScopedSet *vars) {
         int right_result = this->right_.init_check(ss, vars);
         int left_result = this->left_.init_check(ss, vars);
 
@@ -502,24 +511,22 @@ namespace AST {
 
     }
 
-    int Not::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
+    int Not::init_check(StaticSemantics *ss, ScopedSet *vars) {
         int result = this->left_.init_check(ss, vars);
         return result;
     }
 
-    int Dot::init_check(StaticSemantics *ss, std::set<std::string> *vars) {
-        std::set<std::string>* temp_args = new std::set<std::string>(*vars);
-//        int r_result = this->right_.init_check(ss, temp_args);
+    int Dot::init_check(StaticSemantics *ss, ScopedSet *vars) {
+//        int r_result = this->right_.init_check(ss, vars);
 //        if (!r_result) {
 //            std::cout<< "Error in Dot Right Part" <<endl;
 //            return 0;
 //        }
-        int l_result = this->left_.init_check(ss, temp_args);
+        int l_result = this->left_.init_check(ss, vars);
         if (!l_result) {
             std::cout<< "Error in Dot Left Part" <<endl;
             return 0;
         }
-        vars->insert(temp_args->begin(), temp_args->end());
         return 1;
     }
 
@@ -529,278 +536,291 @@ namespace AST {
         //return this->right_.get_text();
     }
 
+    Symbol Dot::get_sym() {
+        if (path_ == sym::EMPTY) {
+            path_ = Symbol::intern(get_text());
+        }
+        return path_;
+    }
+
 
     /* IMPLEMENT ALL THE TYPE INFERENCE METHODS */
 
-    std::string Program::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        // type inference for each class in classes
-        AST::Classes classes = this->classes_;
-        vector < AST::Class * > class_list = classes.elements_;
-        for (AST::Class *clazz: class_list) {
-            std::string cls_name = clazz->name_.text_;
-            std::cout << "Type Inferring Class: " << cls_name << endl;
-            ClassNode* cn = &((ss->class_hierarchy)[cls_name]);
-            std::map<std::string, std::string>* class_args = &(cn->instance_vars);
-            std::string class_result = clazz->type_infer(ss, class_args, cls_name, cur_method);
-            if (class_result=="Top") {
-                return "Top";
-            }
-        }
+    TypeId Program::type_infer_statements(StaticSemantics *ss, TypeEnv* context) {
         // type infer each statement in the statement block that comes after the classes
-        AST::Block statements = this->statements_;
-        vector < AST::ASTNode * > statement_list =  statements.elements_;
-        for (AST::ASTNode *stmt: statement_list) {
-            std::cout << "Type Inferring Statement: " << stmt->str() << endl;
-            std::string stmt_result = stmt->type_infer(ss, context, "$main", "$meth");
-            if (stmt_result=="Top") {
-                return "Top";
+        for (AST::ASTNode *stmt: this->statements_) {
+            ss->log() << "Type Inferring Statement: " << stmt->str() << endl;
+            TypeId stmt_result = stmt->type_infer(ss, context, sym::main_class, sym::main_method);
+            if (stmt_result==types::Top) {
+                return types::Top;
             }
         }
-        return "Ok";
+        return types::Ok;
     }
 
-    std::string Formal::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        Ident formal_arg = this->var_;
-        string arg = formal_arg.text_;
-        string type = this->type_.text_;
-        std::cout << "Adding formal arg: " << arg << " with type: "<< type << endl;
-        (*context)[arg] = type;
-        return "Ok";
+    TypeId Formal::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        Symbol arg = this->var_.sym_;
+        TypeId type = ss->type_id(this->type_.sym_);
+        ss->log() << "Adding formal arg: " << arg << " with type: "<< this->type_.sym_ << endl;
+        context->set(arg, type);
+        return types::Ok;
     }
 
-    std::string Method::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
+    TypeId Method::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
         // init check formal args - add
-        std::string dis_method = this->name_.text_;
+        Symbol dis_method = this->name_.sym_;
         //TODO later check if its an inherited method and make sure it gets all those types
-        for (Formal* fml : this->formals_.elements_) {
-            std::string fml_result = fml->type_infer(ss, context, cur_class, dis_method);
-            if (fml_result=="Top") {
-                std::cout << "Type Infer Method Checking Results: Formal Arg Result: " << fml_result <<endl;
-                return "Top";
+        for (Formal* fml : this->formals_) {
+            TypeId fml_result = fml->type_infer(ss, context, cur_class, dis_method);
+            if (fml_result==types::Top) {
+                ss->log() << "Type Infer Method Checking Results: Formal Arg Result: " << ss->type_name(fml_result) <<endl;
+                return types::Top;
             }
         }
         // type infer method body
-        AST::Block statements = this->statements_;
-        vector < AST::ASTNode * > statement_list =  statements.elements_;
-        for (AST::ASTNode *stmt: statement_list) {
-            std::string stmt_result = stmt->type_infer(ss, context, cur_class, dis_method);
-            std::cout<<stmt->str()<<endl;
-            if (stmt_result == "Top") {
-                std::cout << "Type Infer Method Checking Results in class: "<<cur_class<<" and Method: " << dis_method<<endl;
-                return "Top";
+        for (AST::ASTNode *stmt: this->statements_) {
+            TypeId stmt_result = stmt->type_infer(ss, context, cur_class, dis_method);
+            ss->log()<<stmt->str()<<endl;
+            if (stmt_result == types::Top) {
+                ss->log() << "Type Infer Method Checking Results in class: "<<cur_class<<" and Method: " << dis_method<<endl;
+                return types::Top;
             }
         }
-        return "Ok";
+        return types::Ok;
 
     }
-    /*  statement: l_expr '=' expr ';'
-    { $$ = new AST::Assign(*$1, *$3); };*/
-    std::string Assign::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        //std::set<std::string>* temp_args = new std::set<std::string>(*vars);
-        std::string r_result = this->rexpr_.type_infer(ss, context, cur_class, cur_method);
-        std::cout<< "VARIABLE TYPE "<< r_result <<endl;
-        if ((r_result== "Top") or (r_result =="")) { //TODO why am I getting a blank result?
-            std::cout<< "Error in Assign Right Part" <<endl;
-            return "Top";
-        }
-        std::string var_name = this->lexpr_.get_text();
-        std::cout<< "VARIABLE NAME "<< var_name <<endl;
+    // a variable: its type widens to take the value
+    TypeId ASTNode::type_infer_store(StaticSemantics *ss, TypeEnv* context, TypeId r_result, Symbol cur_class, Symbol cur_method) {
+        Symbol var_name = this->get_sym();
+        ss->log()<< "VARIABLE NAME "<< var_name <<endl;
         // if variable is already in the table we have to get the lca
-        std::string new_type;
-        if (context->count(var_name)) {
+        TypeId new_type;
+        if (context->contains(var_name)) {
             //get the current type in the table
-            std::string cur_type = (*context)[var_name];
-            std::cout<< "CURRENT TYPE "<< cur_type <<endl;
-            if (r_result == "") {
+            TypeId cur_type = *context->find(var_name);
+            ss->log()<< "CURRENT TYPE "<< ss->type_name(cur_type) <<endl;
+            if (r_result == types::Unset) {
                 return cur_type;
             }
             //get the lca
             new_type = ss->lca(cur_type, r_result);
-            std::cout<< "NEW TYPE "<< new_type <<endl;
+            ss->log()<< "NEW TYPE "<< ss->type_name(new_type) <<endl;
             // if they are not the same set the changed flag! (if they are, don't say anything changed)
             if (cur_type != new_type) {
-                ss->changed = true;
+                ss->note_changed();
                 // update the current context and also the class hierarchy table
-                (*context)[var_name] = new_type;
+                context->set(var_name, new_type);
 //                ClassNode cn = (ss->class_hierarchy)[cur_class];
 //                MethodNode mn = (cn.methods)[cur_method];
 //                (mn.local_vars)[var_name] = new_type;
             }
         } else { // if not in the table, we are adding something, set the changed flag!
-            std::cout<< "R RESULT: "<<r_result<<endl;
+            ss->log()<< "R RESULT: "<<ss->type_name(r_result)<<endl;
             new_type = r_result;
-            (*context)[var_name] = new_type;
-            //ss->changed = true;
+            context->set(var_name, new_type);
+            //ss->note_changed();
         }
         return new_type;
     }
+
+    /*  statement: l_expr '=' expr ';'
+    { $$ = new AST::Assign(*$1, *$3); };*/
+    TypeId Assign::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        //std::set<Symbol>* temp_args = new std::set<Symbol>(*vars);
+        TypeId r_result = this->rexpr_.type_infer(ss, context, cur_class, cur_method);
+        ss->log()<< "VARIABLE TYPE "<< ss->type_name(r_result) <<endl;
+        if ((r_result== types::Top) or (r_result ==types::Unset)) { //TODO why am I getting a blank result?
+            ss->log()<< "Error in Assign Right Part" <<endl;
+            return types::Top;
+        }
+        return this->lexpr_.type_infer_store(ss, context, r_result, cur_class, cur_method);
+    }
     /*statement: l_expr ':' ident '=' expr ';'
     {$$ = new AST::AssignDeclare(*$1, *$5, *$3);};*/
-    std::string AssignDeclare::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        //std::set<std::string>* temp_args = new std::set<std::string>(*vars);
-        std::string r_result = this->rexpr_.type_infer(ss, context, cur_class, cur_method);
-        std::string type = this->static_type_.text_;
+    TypeId AssignDeclare::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        //std::set<Symbol>* temp_args = new std::set<Symbol>(*vars);
+        TypeId r_result = this->rexpr_.type_infer(ss, context, cur_class, cur_method);
+        TypeId type = ss->type_id(this->static_type_.sym_);
         if (r_result == type) {
-            std::string var_name = this->lexpr_.get_text();
-            (*context)[var_name] = type;
-            ClassNode cn = (ss->class_hierarchy)[cur_class];
-            MethodNode mn = (cn.methods)[cur_method];
-            (mn.local_vars)[var_name] = type;
+            if (this->lexpr_.type_infer_store(ss, context, type, cur_class, cur_method) == types::Top) {
+                return types::Top;
+            }
             return r_result;
         }
-        std::cout<< "Error in AssignDeclare Type Inference " <<endl;
-        return "Top";
+        ss->log()<< "Error in AssignDeclare Type Inference " <<endl;
+        return types::Top;
     }
 
-    std::string Return::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        std::string result = this->expr_.type_infer(ss, context, cur_class, cur_method);
-        ClassNode cn = ss->class_hierarchy[cur_class];
-        std::cout << "Class Node: "<<cn.name_<<endl;
-//        std::map<string, MethodNode> methods = cn->methods;
-//        MethodNode* mn = &(methods[cur_method]);
-        MethodNode mn = (cn.methods)[cur_method];
-        std::cout << "Method Node: "<<mn.name<<endl;
-        std::string should_return = mn.return_type;
+    TypeId Return::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        TypeId result = this->expr_.type_infer(ss, context, cur_class, cur_method);
+        const ClassNode* cn = ss->find_class(cur_class);
+        ss->log() << "Class Node: "<<(cn ? cn->name_ : sym::EMPTY)<<endl;
+        const MethodNode* mn = ss->find_method(cur_class, cur_method);
+        ss->log() << "Method Node: "<<(mn ? mn->name : sym::EMPTY)<<endl;
 //        if (result != should_return) {
-//            std::cout << "Error in Method Checking Results Return Result: " << result << " should return "<< should_return<<endl;
-//            return "Top";
+//            ss->log() << "Error in Method Checking Results Return Result: " << result << " should return "<< should_return<<endl;
+//            return types::Top;
 //        }
         return result;
     }
 
-    std::string If::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        std::string cond_result = this->cond_.type_infer(ss, context, cur_class, cur_method);
-        std::cout << "Evaluating If Statement " <<endl;
-        if (cond_result == "Boolean"){
-            std::map<std::string, std::string>* true_args = new std::map<std::string, std::string>(*context);
-            // true and false are seqs of ASTNodes
-            //AST::Block statements = this->statements_;
-            vector < AST::ASTNode * > true_list =  this->truepart_.elements_;
-            for (AST::ASTNode *true_item: true_list) {
-                std::string result = true_item->type_infer(ss, true_args, cur_class, cur_method);
-                if (result=="Top") {
-                    std::cout << "Error in If Statement True Part: " << true_item->str()<<endl;
+    TypeId If::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        TypeId cond_result = this->cond_.type_infer(ss, context, cur_class, cur_method);
+        ss->log() << "Evaluating If Statement " <<endl;
+        if (cond_result == types::Boolean){
+            // true and false are seqs of ASTNodes, each checked in its own scope
+            // (on an error we give up on the whole unit, so scopes are left open)
+            std::vector<TypeEnv::Branch> branches;
+            context->push();
+            for (AST::ASTNode *true_item: this->truepart_) {
+                TypeId result = true_item->type_infer(ss, context, cur_class, cur_method);
+                if (result==types::Top) {
+                    ss->log() << "Error in If Statement True Part: " << true_item->str()<<endl;
                     return result;
                 }
             }
-            std::map<std::string, std::string>* false_args = new std::map<std::string, std::string>(*context);
-            vector < AST::ASTNode * > false_list =  this->falsepart_.elements_;
-            for (AST::ASTNode *false_item: false_list) {
-                std::string result = false_item->type_infer(ss, true_args, cur_class, cur_method);
-                if (result=="Top") {
-                    std::cout << "Error in If Statement False Part: " << false_item->str()<<endl;
+            branches.push_back(context->pop());
+            context->push();
+            for (AST::ASTNode *false_item: this->falsepart_) {
+                TypeId result = false_item->type_infer(ss, context, cur_class, cur_method);
+                if (result==types::Top) {
+                    ss->log() << "Error in If Statement False Part: " << false_item->str()<<endl;
                     return result;
                 }
             }
-            // add the intersecting variables of true and false parts if every section type init OK
-            for (std::pair<std::string,std::string> element : *true_args) {
-                std::string var_name = element.first;
-                if ((false_args->count(var_name))) {
-                    (*context)[var_name] = element.second;
-                }
+            branches.push_back(context->pop());
+            // keep what both parts agree on, joining the types of variables either part changed
+            if (context->join(branches, false, [ss](TypeId a, TypeId b) { return ss->lca(a, b); })) {
+                ss->note_changed();
             }
-            return "Ok";
+            return types::Ok;
         }
-        return "Top";
-    }
-
-    std::string While::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        // type check the condition and the statements, don't update the vars table
-        std::string cond_result = this->cond_.type_infer(ss, context, cur_class, cur_method);
-        if (cond_result == "Boolean"){
-            std::map<std::string, std::string>* temp_vars = new std::map<std::string, std::string>(*context);
-            vector < AST::ASTNode * > body_list =  this->body_.elements_;
-            for (AST::ASTNode *body_item: body_list) {
-                std::string result = body_item->type_infer(ss, temp_vars, cur_class, cur_method);
-                if (result == "Top") {
-                    std::cout << "Error in While Statement Body: " << result<<endl;
-                    return "Top";
+        return types::Top;
+    }
+
+    TypeId While::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        // type check the condition and the statements; the body may run zero times
+        TypeId cond_result = this->cond_.type_infer(ss, context, cur_class, cur_method);
+        if (cond_result == types::Boolean){
+            context->push();
+            for (AST::ASTNode *body_item: this->body_) {
+                TypeId result = body_item->type_infer(ss, context, cur_class, cur_method);
+                if (result == types::Top) {
+                    ss->log() << "Error in While Statement Body: " << ss->type_name(result)<<endl;
+                    return types::Top;
                 }
             }
-            return "Ok";
+            std::vector<TypeEnv::Branch> branches{context->pop()};
+            // a variable the body widened is wider on the next trip around, so check again
+            if (context->join(branches, true, [ss](TypeId a, TypeId b) { return ss->lca(a, b); })) {
+                ss->note_changed();
+            }
+            return types::Ok;
         }
-        return "Top";
+        return types::Top;
     }
 
-    std::string Typecase::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        //TODO something here?
-        return "Ok";
+    TypeId Typecase::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        TypeId expr_result = this->expr_.type_infer(ss, context, cur_class, cur_method);
+        if (expr_result == types::Top) {
+            ss->log() << "Error in Typecase Expression: " << expr_.str() <<endl;
+            return types::Top;
+        }
+        // each alternative in its own scope; no alternative may match at all
+        std::vector<TypeEnv::Branch> branches;
+        for (Type_Alternative *alt : this->cases_) {
+            context->push();
+            TypeId result = alt->type_infer(ss, context, cur_class, cur_method);
+            if (result == types::Top) {
+                return types::Top;
+            }
+            branches.push_back(context->pop());
+        }
+        if (context->join(branches, true, [ss](TypeId a, TypeId b) { return ss->lca(a, b); })) {
+            ss->note_changed();
+        }
+        return types::Ok;
     }
 
-    std::string Type_Alternative::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        //TODO something here?
-        return "Ok";
+    TypeId Type_Alternative::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        // the variable has the type of the alternative inside its block
+        TypeId type = ss->type_id(this->classname_.sym_);
+        if (type == types::Top) {
+            ss->log() << "Error in Typecase: unknown class " << this->classname_.sym_ <<endl;
+            return types::Top;
+        }
+        context->set(this->ident_.sym_, type);
+        for (AST::ASTNode *stmt: this->block_) {
+            TypeId result = stmt->type_infer(ss, context, cur_class, cur_method);
+            if (result == types::Top) {
+                ss->log() << "Error in Typecase Alternative: " << stmt->str() <<endl;
+                return types::Top;
+            }
+        }
+        return types::Ok;
     }
 
-    std::string Load::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        //std::cout << "Load loc: " << this->loc_.str() <<endl;
+    TypeId Load::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        //ss->log() << "Load loc: " << this->loc_.str() <<endl;
         return this->loc_.type_infer(ss, context, cur_class, cur_method);
     }
 
-    std::string Ident::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-//        std::cout << "Current Vars: " << endl;
-//        for (std::pair<std::string, string> element : *context) {
-//            std::cout << element.first << " with type "<<element.second<< endl;
+    TypeId Ident::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+//        ss->log() << "Current Vars: " << endl;
+//        for (std::pair<Symbol, TypeId> element : *context) {
+//            ss->log() << element.first << " with type "<<element.second<< endl;
 //        }
-        if ((context->count(this->text_))) {
-            return (*context)[this->text_];
+        const TypeId* found = context->find(this->sym_);
+        if (found != nullptr) {
+            return *found;
         } else {
-            std::cout << "ERROR Can't find Type of Variable: " << this->text_ << endl;
-            return "Top";
+            ss->log() << "ERROR Can't find Type of Variable: " << this->sym_ << endl;
+            return types::Top;
         }
     }
 
-    std::string Class::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
+    TypeId Class::type_infer_constructor(StaticSemantics *ss, TypeEnv* context) {
         // check that the constructor initializes all class level vars (like any normal method)
-        std::string dis_class = this->name_.text_;
-        ClassNode cn = ss->class_hierarchy[dis_class];
-        MethodNode mn = cn.constructor_;
-        std::string should_return = mn.return_type;
-        std::cout<< "Class should return type "<< should_return << endl;
-        (*context)["this"] = should_return;
+        Symbol dis_class = this->name_.sym_;
+        const ClassNode* cn = ss->find_class(dis_class);
+        TypeId should_return = cn->constructor_.return_type;
+        ss->log()<< "Class should return type "<< ss->type_name(should_return) << endl;
+        context->set(sym::this_, should_return);
+        return this->constructor_.type_infer(ss, context, dis_class, dis_class);
+    }
 
-        std::string const_result = this->constructor_.type_infer(ss, context, dis_class, dis_class);
-        if (const_result== "Top") {
-            std::cout<< "Type Error in Constructor" << endl;
-            return const_result;
+    TypeId Call::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method){
+        //type infer the receiver
+        TypeId receiver = this->receiver_.type_infer(ss, context, cur_class, cur_method);
+        Symbol method_call = this->method_.sym_;
+        this->receiver_type_ = receiver; // codegen picks the method slot from this
+        if (receiver == types::Top) {
+            return types::Top;
         }
-
-        // now check all the methods
-        vector < AST::Method * > method_list = this->methods_.elements_;
-        for (AST::Method *method: method_list) {
-            //std::map<std::string, std::string>* method_args = new std::map<std::string, std::string>(*context);
-            std::string dis_method = method->name_.text_;
-            MethodNode mn = (cn.methods)[dis_method];
-            std::map<std::string, std::string>* method_args = &(mn.local_vars);
-            method_args->insert(context->begin(), context->end());
-            std::cout<< "CURRENT VARS: "<<endl;
-            for (std::pair<std::string, string> element : *method_args) {
-                std::cout << element.first << " with type "<<element.second<< endl;
-            }
-            std::cout<< "About to check method: "<<dis_method<<endl;
-            std::string meth_return = method->type_infer(ss, method_args, dis_class, dis_method);
-            if (meth_return=="Top") {
-                return "Top";
+        // the arguments are not checked against the formals yet, but calls inside them need their receiver types too
+        for (Expr* arg : this->actuals_) {
+            if (arg->type_infer(ss, context, cur_class, cur_method) == types::Top) {
+                ss->log() << "Error checking args of method call " << method_call <<endl;
+                return types::Top;
             }
         }
-        // TODO anything inherited from the superclass needs to be consistent
-
-        return "Ok";
-    }
-
-    std::string Call::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method){
-        //type infer the receiver
-        std::string receiver = this->receiver_.type_infer(ss, context, cur_class, cur_method);
-        std::string method_call = this->method_.get_text();
 
         //look up the method name in the receiver class
-        ClassNode* cn = &(ss->class_hierarchy[receiver]);
-        std::cout<< "Got Class Node: "<<cn->name_<< " for receiver "<<this->receiver_.get_text()<<" and type "<<receiver<<endl;
-        //TODO in case the method isn't there check count
-        MethodNode mn = cn->methods[method_call];
-        std::cout<< "Got Method Node: "<<mn.name<< " for method " << method_call<<endl;
-        std::string should_return = mn.return_type;
-        std::cout<< "Method Call: "<<method_call<<" Should Return: "<< should_return<<endl;
+        ClassNode* cn = ss->class_node(receiver);
+        if (cn == nullptr) {
+            ss->log()<< "No Class Node for receiver "<<this->receiver_.get_text()<<" of type "<<ss->type_name(receiver)<<endl;
+            return types::Unset;
+        }
+        ss->log()<< "Got Class Node: "<<cn->name_<< " for receiver "<<this->receiver_.get_text()<<" and type "<<ss->type_name(receiver)<<endl;
+        //TODO check count
+        const MethodNode* mn = ss->find_method(cn->name_, method_call);
+        if (mn == nullptr) {
+            ss->log()<< "Error in Method Call: no method " << method_call << " in class " << cn->name_ <<endl;
+            return types::Top;
+        }
+        ss->log()<< "Got Method Node: "<<mn->name<< " for method " << method_call<<endl;
+        TypeId should_return = mn->return_type;
+        ss->log()<< "Method Call: "<<method_call<<" Should Return: "<< ss->type_name(should_return)<<endl;
 
         // TODO can check if actual arguments are correct, skipping for now
         // returns the return type of the method
@@ -808,105 +828,909 @@ namespace AST {
 
     }
 
-    std::string Construct::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
+    TypeId Construct::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
         // we are creating a new object
-        cur_class = this->method_.get_text();
-        cur_method = this->method_.get_text();
+        cur_class = this->method_.sym_;
+        cur_method = this->method_.sym_;
         //  type infer the passed args
-        Actuals actual_args = this->actuals_;
-        vector < Expr * > arg_list = actual_args.elements_;
-        for (Expr* arg : arg_list) {
-            if (arg->type_infer(ss, context, cur_class, cur_method) == "Top") {
-                std::cout << "Error checking args of constructor"<<endl;
-                return "Top";
+        for (Expr* arg : this->actuals_) {
+            if (arg->type_infer(ss, context, cur_class, cur_method) == types::Top) {
+                ss->log() << "Error checking args of constructor"<<endl;
+                return types::Top;
             }
         }
         // all is good, look up the return type in the class hierarchy and return it
-        ClassNode cn = ss->class_hierarchy[cur_class];
-        //std::cout<< "Got Class Node: "<<cn.name_<< " for construct type "<<cur_method<<endl;
-        MethodNode mn = cn.constructor_;
-        //std::cout<< "Got Method Node: "<<mn.name<<endl;
-        std::string should_return = mn.return_type;
+        const ClassNode* cn = ss->find_class(cur_class);
+        //ss->log()<< "Got Class Node: "<<cn->name_<< " for construct type "<<cur_method<<endl;
+        TypeId should_return = cn ? cn->constructor_.return_type : types::Unset;
 
         return should_return;
 
     }
 
-    std::string IntConst::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        return "Int";
+    TypeId IntConst::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        return types::Int;
     }
 
-    std::string StrConst::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        return "String";
+    TypeId StrConst::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        return types::String;
     }
 
-    std::string And::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        std::string right_result = this->right_.type_infer(ss, context, cur_class, cur_method);
-        std::string left_result = this->left_.type_infer(ss, context, cur_class, cur_method);
+    TypeId And::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        TypeId right_result = this->right_.type_infer(ss, context, cur_class, cur_method);
+        TypeId left_result = this->left_.type_infer(ss, context, cur_class, cur_method);
 
-        if (right_result=="Boolean" and left_result=="Boolean") {
-            return "Boolean";
+        if (right_result==types::Boolean and left_result==types::Boolean) {
+            return types::Boolean;
         } else {
-            return "Top";
+            return types::Top;
         }
     }
 
-    std::string Or::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        std::string right_result = this->right_.type_infer(ss, context, cur_class, cur_method);
-        std::string left_result = this->left_.type_infer(ss, context,cur_class, cur_method);
+    TypeId Or::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        TypeId right_result = this->right_.type_infer(ss, context, cur_class, cur_method);
+        TypeId left_result = this->left_.type_infer(ss, context,cur_class, cur_method);
 
-        if (right_result=="Boolean" and left_result=="Boolean") {
-            return "Boolean";
+        if (right_result==types::Boolean and left_result==types::Boolean) {
+            return types::Boolean;
         } else {
-            return "Top";
+            return types::Top;
         }
 
     }
 
-    std::string Not::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        std::string result = this->left_.type_infer(ss, context, cur_class, cur_method);
-        if (result == "Boolean") {
-            return "Boolean";
+    TypeId Not::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        TypeId result = this->left_.type_infer(ss, context, cur_class, cur_method);
+        if (result == types::Boolean) {
+            return types::Boolean;
         } else {
-            return "Top";
+            return types::Top;
         }
     }
 
-    std::string Dot::type_infer(StaticSemantics *ss, map<std::string, std::string>* context, string cur_class, string cur_method) {
-        //std::cout<< "IS THIS A THIS "<< this->left_.get_text() <<endl;
+    ClassNode *Dot::left_class(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
         //get the type of the left (this or other, etc.) then dig that type out of the class hierarchy
-        std::string l_result = this->left_.type_infer(ss, context, cur_class, cur_method);
-        ClassNode* cn = &((ss->class_hierarchy)[l_result]);
-        std::map<std::string, std::string>* cls_table = &(cn->instance_vars);
-        std::cout<< "DOT CURRENT VARS: "<<endl;
-        for (std::pair<std::string, string> element : *cls_table) {
-            std::cout << element.first << " with type "<<element.second<< endl;
+        TypeId l_result = this->left_.type_infer(ss, context, cur_class, cur_method);
+        this->left_type_ = l_result;
+        ClassNode* cn = ss->class_node(l_result);
+        if (cn == nullptr) {
+            ss->log()<< "Error while Type Inferring Dot: no class " << ss->type_name(l_result) <<endl;
+        }
+        return cn;
+    }
+
+    TypeId Dot::type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+        ClassNode* cn = this->left_class(ss, context, cur_class, cur_method);
+        if (cn == nullptr) {
+            return types::Top;
+        }
+        const TypeId *field = ss->field_type(cn, Symbol::intern("this." + this->right_.sym_.str()));
+        if (field == nullptr) {
+            ss->log()<< "Error while Type Inferring Dot: no instance variable " << this->right_.sym_
+                     << " in class " << cn->name_ <<endl;
+            return types::Top;
+        }
+        return *field;
+    }
+
+    TypeId Dot::type_infer_store(StaticSemantics *ss, TypeEnv* context, TypeId type, Symbol cur_class, Symbol cur_method) {
+        ClassNode* cn = this->left_class(ss, context, cur_class, cur_method);
+        if (cn == nullptr) {
+            return types::Top;
+        }
+        // a constructor makes the instance variables of its own object as it sets them
+        if (this->left_.get_sym() == sym::this_ && ss->constructing(cn)) {
+            return ASTNode::type_infer_store(ss, context, type, cur_class, cur_method);
+        }
+        Symbol name = Symbol::intern("this." + this->right_.sym_.str());
+        TypeId owner = types::Unset;
+        const TypeId *field = ss->field_type(cn, name, &owner);
+        if (field == nullptr) {
+            ss->log()<< "Error in Assign: no instance variable " << this->right_.sym_
+                     << " in class " << cn->name_ <<endl;
+            return types::Top;
+        }
+        // every unit that reads the fields of the owner sees the wider type, once this unit is merged
+        TypeId new_type = ss->lca(*field, type);
+        if (new_type != *field) {
+            ss->note_field_write(owner, name, new_type);
+        }
+        return new_type;
+    }
+
+    /* CONSTANT FOLDING
+     *
+     * After the static semantics, and before code generation: an Int,
+     * String or Boolean expression made only of constants is worked out
+     * here, so the code just loads a static literal instead of making
+     * objects and calling methods at run time.  We do what the built-in
+     * methods would do, in C int arithmetic; a division by zero is
+     * left for run time.  Then an if whose condition is a constant is
+     * replaced by the branch it takes, and a loop that never runs
+     * disappears.
+     */
+
+    Constant Program::fold() {
+        this->classes_.fold();
+        this->statements_.fold_statements();
+        return folded_;
+    }
+
+    Constant Class::fold() {
+        this->constructor_.fold();
+        this->methods_.fold();
+        return folded_;
+    }
+
+    Constant Method::fold() {
+        this->statements_.fold_statements();
+        return folded_;
+    }
+
+    Constant Ident::fold() {
+        if (this->sym_ == sym::true_ || this->sym_ == sym::True) {
+            folded_ = Constant::of(types::Boolean, 1);
+        } else if (this->sym_ == sym::false_ || this->sym_ == sym::False) {
+            folded_ = Constant::of(types::Boolean, 0);
+        }
+        return folded_;
+    }
+
+    Constant Load::fold() {
+        folded_ = this->loc_.fold();
+        return folded_;
+    }
+
+    Constant Dot::fold() {
+        this->left_.fold();
+        return folded_;
+    }
+
+    Constant Assign::fold() {
+        this->lexpr_.fold();
+        this->rexpr_.fold();
+        return folded_;
+    }
+
+    Constant Return::fold() {
+        this->expr_.fold();
+        return folded_;
+    }
+
+    Constant If::fold() {
+        this->cond_.fold();
+        this->truepart_.fold_statements();
+        this->falsepart_.fold_statements();
+        return folded_;
+    }
+
+    void If::fold_into(std::vector<ASTNode *> &statements) {
+        Constant cond = this->cond_.fold();
+        if (cond.type != types::Boolean) {
+            this->fold();
+            statements.push_back(this);
+            return;
+        }
+        // a constant has no side effects, so only the branch taken is left
+        for (ASTNode *stmt: cond.value ? this->truepart_ : this->falsepart_) {
+            stmt->fold_into(statements);
+        }
+    }
+
+    Constant While::fold() {
+        this->cond_.fold();
+        this->body_.fold_statements();
+        return folded_;
+    }
+
+    void While::fold_into(std::vector<ASTNode *> &statements) {
+        Constant cond = this->cond_.fold();
+        if (cond.type == types::Boolean && !cond.value) {
+            return;
+        }
+        this->body_.fold_statements();
+        statements.push_back(this);
+    }
+
+    Constant Typecase::fold() {
+        this->expr_.fold();
+        this->cases_.fold();
+        return folded_;
+    }
+
+    Constant Type_Alternative::fold() {
+        this->block_.fold_statements();
+        return folded_;
+    }
+
+    Constant IntConst::fold() {
+        folded_ = Constant::of(types::Int, this->value_);
+        return folded_;
+    }
+
+    // The characters of a string literal, which the scanner keeps as written
+    Constant StrConst::fold() {
+        std::string text;
+        for (size_t i = 0; i < this->value_.size(); i++) {
+            char c = this->value_[i];
+            if (c == '\\' && i + 1 < this->value_.size()) {
+                switch (this->value_[++i]) {
+                    case '0': c = '\0'; break;
+                    case 'b': c = '\b'; break;
+                    case 't': c = '\t'; break;
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 'f': c = '\f'; break;
+                    default: c = this->value_[i];   // \" and \\ .
+                }
+            }
+            text += c;
+        }
+        folded_ = Constant::of_text(text);
+        return folded_;
+    }
+
+    Constant Construct::fold() {
+        this->actuals_.fold();
+        return folded_;
+    }
+
+    // Int arithmetic and comparison as the built-in methods do it, on C ints
+    static Constant fold_int(Symbol method, int left, int right) {
+        unsigned l = (unsigned) left;
+        unsigned r = (unsigned) right;
+        if (method == sym::PLUS) return Constant::of(types::Int, (int) (l + r));
+        if (method == sym::MINUS) return Constant::of(types::Int, (int) (l - r));
+        if (method == sym::TIMES) return Constant::of(types::Int, (int) (l * r));
+        if (method == sym::DIVIDE) {
+            if (right == 0 || (right == -1 && left == INT_MIN)) {
+                return Constant();
+            }
+            return Constant::of(types::Int, left / right);
+        }
+        if (method == sym::LESS) return Constant::of(types::Boolean, left < right);
+        if (method == sym::MORE) return Constant::of(types::Boolean, left > right);
+        if (method == sym::ATMOST) return Constant::of(types::Boolean, left <= right);
+        if (method == sym::ATLEAST) return Constant::of(types::Boolean, left >= right);
+        if (method == sym::EQUALS) return Constant::of(types::Boolean, left == right);
+        return Constant();
+    }
+
+    static Constant fold_string(Symbol method, const std::string &left, const std::string &right) {
+        if (method == sym::PLUS) return Constant::of_text(left + right);
+        if (method == sym::EQUALS) return Constant::of(types::Boolean, left == right);
+        // like memcmp, and a prefix comes first
+        if (method == sym::LESS) return Constant::of(types::Boolean, left < right);
+        return Constant();
+    }
+
+    Constant Call::fold() {
+        Constant receiver = this->receiver_.fold();
+        std::vector<Constant> args;
+        for (Expr *actual: this->actuals_) {
+            args.push_back(actual->fold());
+        }
+        Symbol method = this->method_.sym_;
+        if (args.empty()) {
+            if (receiver.type == types::Int && method == sym::STR) {
+                folded_ = Constant::of_text(std::to_string(receiver.value));
+            }
+        } else if (args.size() == 1 && args[0].type == receiver.type) {
+            if (receiver.type == types::Int) {
+                folded_ = fold_int(method, (int) receiver.value, (int) args[0].value);
+            } else if (receiver.type == types::String) {
+                folded_ = fold_string(method, receiver.text, args[0].text);
+            }
+        }
+        return folded_;
+    }
+
+    /* 'and' and 'or' decide on the left side if they can; with a constant
+     * left side that does not decide, they are the right side.
+     */
+    Constant And::fold() {
+        Constant left = this->left_.fold();
+        Constant right = this->right_.fold();
+        if (left.type == types::Boolean && (!left.value || right.type == types::Boolean)) {
+            folded_ = left.value ? right : left;
+        }
+        return folded_;
+    }
+
+    Constant Or::fold() {
+        Constant left = this->left_.fold();
+        Constant right = this->right_.fold();
+        if (left.type == types::Boolean && (left.value || right.type == types::Boolean)) {
+            folded_ = left.value ? left : right;
         }
-        std::string r_result = this->right_.type_infer(ss, cls_table, l_result, l_result);
-        if (r_result == "Top") {
-            std::cout<< "Error while Type Inferring Dot" <<endl;
+        return folded_;
+    }
+
+    Constant Not::fold() {
+        Constant left = this->left_.fold();
+        if (left.type == types::Boolean) {
+            folded_ = Constant::of(types::Boolean, !left.value);
+        }
+        return folded_;
+    }
+
+    /* CODE GENERATION
+     *
+     * We translate to the IR (IR.h), which the C backend prints.  Every
+     * Quack value is an object, except that an Int or Boolean whose type
+     * we know can be a plain C int.  A method call names the slot of the
+     * method in the receiver's method table (see ClassLayout in
+     * staticsemantics.cpp), so no call looks up a method by name at run time.
+     */
+
+    // the layout of a class we can generate code for, or nullptr
+    static const ClassLayout *layout_of(StaticSemantics *ss, TypeId clazz) {
+        if (clazz < types::Nothing || clazz >= (TypeId) ss->layouts.size()) {
+            return nullptr;
+        }
+        return &ss->layouts[clazz];
+    }
+
+    /* A folded constant is a static literal object.  The string
+     * pool wants C text, and an octal escape always has three digits,
+     * so a digit after one stays a digit.
+     */
+    static void gen_constant(CodegenContext& ctx, const Constant &value, std::string target_reg) {
+        if (value.type == types::Int) {
+            ctx.literal(target_reg, ctx.int_literal(value.value));
+        } else if (value.type == types::Boolean) {
+            ctx.literal(target_reg, value.value ? "lit_true" : "lit_false");
+        } else {
+            std::string literal;
+            for (unsigned char c : value.text) {
+                if (c == '"' || c == '\\') {
+                    literal += '\\';
+                    literal += (char) c;
+                } else if (c == '\n') {
+                    literal += "\\n";
+                } else if (c == '\t') {
+                    literal += "\\t";
+                } else if (c < ' ' || c >= 127) {
+                    char octal[5];
+                    snprintf(octal, sizeof octal, "\\%03o", c);
+                    literal += octal;
+                } else {
+                    literal += (char) c;
+                }
+            }
+            ctx.literal(target_reg, ctx.str_literal(literal));
         }
-        return r_result;
     }
+
+    void Program::gen_program(CodegenContext& ctx) {
+        for (AST::Class *clazz: this->classes_) {
+            clazz->gen_code(ctx);
+        }
+        ctx.begin_function("main", ir::FunctionKind::Main, types::Unset, ctx.ss->variables_of(nullptr, nullptr));
+        std::string target = ctx.alloc_reg();
+        this->gen_rvalue(ctx, target);
+        ctx.end_function();
+    }
+
     void Program::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
         this->statements_.gen_rvalue(ctx, target_reg);
     }
 
+    void Method::gen_params(CodegenContext& ctx, bool with_this) {
+        if (with_this) {
+            ctx.add_param("this");
+        }
+        for (AST::Formal *formal: this->formals_) {
+            ctx.bind_local(formal->var_.sym_, "var_" + formal->var_.sym_.str());
+        }
+    }
+
+    void Class::gen_code(CodegenContext& ctx) {
+        std::string cname = this->name_.sym_.str();
+        TypeId clazz = ctx.ss->type_id(this->name_.sym_);
+        ctx.add_class(clazz);
+        // constructor: allocate, install the method table, run the body
+        ctx.begin_function("new_" + cname, ir::FunctionKind::Constructor, clazz, ctx.ss->variables_of(this, nullptr));
+        this->constructor_.gen_params(ctx, false);
+        ctx.declare("this", true);
+        ctx.alloc("this", clazz);
+        std::string target = ctx.alloc_reg();
+        this->constructor_.statements_.gen_rvalue(ctx, target);
+        ctx.ret("this");
+        ctx.end_function();
+        for (AST::Method *method: this->methods_) {
+            ctx.begin_function(cname + "_method_" + method->name_.sym_.str(), ir::FunctionKind::Method, clazz,
+                               ctx.ss->variables_of(this, method));
+            method->gen_params(ctx, true);
+            target = ctx.alloc_reg();
+            method->statements_.gen_rvalue(ctx, target);
+            ctx.end_function();
+        }
+    }
+
     void Block::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
-        vector < AST::ASTNode * > statement_list =  this->elements_;
-        for (AST::ASTNode *stmt: statement_list) {
+        for (AST::ASTNode *stmt: *this) {
             //std::cout << "STATEMENT" << stmt->str() <<endl;
             stmt->gen_rvalue(ctx, target_reg);
         }
     }
+
+    void Ident::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        if (this->sym_ == sym::this_) {
+            ctx.move(target_reg, "this");
+        } else if (this->sym_ == sym::true_ || this->sym_ == sym::True) {
+            ctx.literal(target_reg, "lit_true");
+        } else if (this->sym_ == sym::false_ || this->sym_ == sym::False) {
+            ctx.literal(target_reg, "lit_false");
+        } else if (this->sym_ == sym::none) {
+            ctx.literal(target_reg, "nothing");
+        } else {
+            TypeId type = ctx.unboxed_type(this->sym_);
+            std::string var = ctx.get_local_var(this->sym_);
+            if (type == types::Unset) {
+                ctx.move(target_reg, var);
+            } else {
+                ctx.box(target_reg, var, type);
+            }
+        }
+    }
+
+    TypeId Ident::unboxed_type(CodegenContext& ctx) {
+        if (this->sym_ == sym::true_ || this->sym_ == sym::True
+            || this->sym_ == sym::false_ || this->sym_ == sym::False) {
+            return types::Boolean;
+        }
+        if (this->sym_ == sym::this_ || this->sym_ == sym::none) {
+            return types::Unset;
+        }
+        return ctx.unboxed_type(this->sym_);
+    }
+
+    void Ident::gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) {
+        if (this->sym_ == sym::true_ || this->sym_ == sym::True) {
+            ctx.int_const(target, 1);
+        } else if (this->sym_ == sym::false_ || this->sym_ == sym::False) {
+            ctx.int_const(target, 0);
+        } else if (this->unboxed_type(ctx) == type) {
+            ctx.move(target, ctx.get_local_var(this->sym_));
+        } else {
+            ASTNode::gen_unboxed(ctx, target, type);
+        }
+    }
+
+    std::string Ident::gen_lvalue(CodegenContext& ctx) {
+        return ctx.get_local_var(this->sym_);
+    }
+
+    void Ident::gen_store(CodegenContext& ctx, std::string value) {
+        ctx.move(this->gen_lvalue(ctx), value);
+    }
+
+    void Load::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        this->loc_.gen_rvalue(ctx, target_reg);
+    }
+
+    /* Fields sit at the same place in subclasses, so the static type of
+     * the object, which type inference checked has the field, tells us
+     * where to look.
+     */
+    void Dot::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        std::string object = ctx.alloc_reg();
+        this->left_.gen_rvalue(ctx, object);
+        ctx.get_field(target_reg, object, this->left_type_, this->right_.sym_);
+        ctx.free_reg(object);
+    }
+
+    void Dot::gen_store(CodegenContext& ctx, std::string value) {
+        std::string object = ctx.alloc_reg();
+        this->left_.gen_rvalue(ctx, object);
+        ctx.set_field(object, this->left_type_, this->right_.sym_, value);
+        ctx.free_reg(object);
+    }
+
+    void Assign::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        TypeId type = this->lexpr_.unboxed_type(ctx);
+        if (type != types::Unset) {
+            // through a temporary: the right side may still read the variable
+            std::string value = ctx.alloc_int_reg();
+            this->rexpr_.gen_unboxed(ctx, value, type);
+            ctx.move(this->lexpr_.gen_lvalue(ctx), value);
+            ctx.free_reg(value);
+            return;
+        }
+        std::string value = ctx.alloc_reg();
+        this->rexpr_.gen_rvalue(ctx, value);
+        this->lexpr_.gen_store(ctx, value);
+        ctx.free_reg(value);
+    }
+
+    void Return::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        std::string value = ctx.alloc_reg();
+        this->expr_.gen_rvalue(ctx, value);
+        ctx.ret(value);
+        ctx.free_reg(value);
+    }
+
+    void ASTNode::gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) {
+        std::string object = ctx.alloc_reg();
+        this->gen_rvalue(ctx, object);
+        ctx.unbox(target, object, type);
+        ctx.free_reg(object);
+    }
+
+    void ASTNode::gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch) {
+        if (this->folded_.type == types::Boolean) {
+            ctx.jump(this->folded_.value ? true_branch : false_branch);
+            return;
+        }
+        std::string flag = ctx.alloc_int_reg();
+        this->gen_unboxed(ctx, flag, types::Boolean);
+        ctx.branch(flag, true_branch, false_branch);
+        ctx.free_reg(flag);
+    }
+
+    void If::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        std::string then_label = ctx.new_branch_label("then");
+        std::string else_label = ctx.new_branch_label("else");
+        std::string end_label = ctx.new_branch_label("endif");
+        this->cond_.gen_branch(ctx, then_label, else_label);
+        ctx.place_label(then_label);
+        for (AST::ASTNode *stmt: this->truepart_) {
+            stmt->gen_rvalue(ctx, target_reg);
+        }
+        ctx.jump(end_label);
+        ctx.place_label(else_label);
+        for (AST::ASTNode *stmt: this->falsepart_) {
+            stmt->gen_rvalue(ctx, target_reg);
+        }
+        ctx.place_label(end_label);
+    }
+
+    void While::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        std::string test_label = ctx.new_branch_label("loop_test");
+        std::string body_label = ctx.new_branch_label("loop_body");
+        std::string end_label = ctx.new_branch_label("loop_end");
+        ctx.place_label(test_label);
+        this->cond_.gen_branch(ctx, body_label, end_label);
+        ctx.place_label(body_label);
+        for (AST::ASTNode *stmt: this->body_) {
+            stmt->gen_rvalue(ctx, target_reg);
+        }
+        ctx.jump(test_label);
+        ctx.place_label(end_label);
+    }
+
+    void Typecase::gen_rvalue(CodegenContext& ctx, std::string target_reg) {
+        std::string value = ctx.alloc_reg();
+        this->expr_.gen_rvalue(ctx, value);
+        std::string end_label = ctx.new_branch_label("endcase");
+        for (AST::Type_Alternative *alternative: this->cases_) {
+            std::string next_label = ctx.new_branch_label("case");
+            alternative->gen_case(ctx, value, next_label, end_label);
+            ctx.place_label(next_label);
+        }
+        ctx.place_label(end_label);
+        ctx.free_reg(value);
+    }
+
+    /* The value matches if its class is the class of the alternative or
+     * one of its subclasses; the hierarchy is closed, so we list them.
+     */
+    void Type_Alternative::gen_case(CodegenContext& ctx, std::string value, std::string next_case, std::string end_case) {
+        StaticSemantics *ss = ctx.ss;
+        TypeId type = ss->type_id(this->classname_.sym_);
+        if (type != types::Obj) {
+            std::string match_label = ctx.new_branch_label("match");
+            ctx.branch_class(value, ss->subclasses(type), match_label, next_case);
+            ctx.place_label(match_label);
+        }
+        TypeId unboxed = ctx.unboxed_type(this->ident_.sym_);
+        std::string var = ctx.get_local_var(this->ident_.sym_);
+        if (unboxed == types::Unset) {
+            ctx.move(var, value);
+        } else {
+            ctx.unbox(var, value, unboxed);
+        }
+        std::string target = ctx.alloc_reg();
+        this->block_.gen_rvalue(ctx, target);
+        ctx.jump(end_case);
+        ctx.free_reg(target);
+    }
+
+    /* Type inference does not always name the receiver's class (e.g., the
+     * result of an inherited method).  We can still call the method if
+     * every class that has it keeps it in the same slot.
+     */
+    static int common_slot(StaticSemantics *ss, Symbol method) {
+        int slot = -1;
+        for (const ClassLayout &layout : ss->layouts) {
+            int found = layout.slot(method);
+            if (found < 0) {
+                continue;
+            }
+            if (slot >= 0 && found != slot) {
+                return -1;
+            }
+            slot = found;
+        }
+        return slot;
+    }
+
+    /* Int arithmetic and comparisons with an Int argument are single C
+     * operators on unboxed values.
+     */
+    static const char *int_operator(Symbol method) {
+        if (method == sym::PLUS) return "+";
+        if (method == sym::MINUS) return "-";
+        if (method == sym::TIMES) return "*";
+        if (method == sym::DIVIDE) return "/";
+        if (method == sym::LESS) return "<";
+        if (method == sym::MORE) return ">";
+        if (method == sym::ATMOST) return "<=";
+        if (method == sym::ATLEAST) return ">=";
+        if (method == sym::EQUALS) return "==";
+        return nullptr;
+    }
+
+    TypeId Call::unboxed_type(CodegenContext &ctx) {
+        if (this->folded_.type == types::Int || this->folded_.type == types::Boolean) {
+            return this->folded_.type;
+        }
+        Symbol method = this->method_.sym_;
+        if (this->receiver_type_ != types::Int || int_operator(method) == nullptr || this->actuals_.size() != 1) {
+            return types::Unset;
+        }
+        // the checker does not look at arguments, so only trust one we can see is an Int
+        if ((*this->actuals_.begin())->unboxed_type(ctx) != types::Int) {
+            return types::Unset;
+        }
+        bool arithmetic = method == sym::PLUS || method == sym::MINUS || method == sym::TIMES || method == sym::DIVIDE;
+        return arithmetic ? types::Int : types::Boolean;
+    }
+
+    void Call::gen_unboxed(CodegenContext &ctx, std::string target, TypeId type) {
+        if (this->unboxed_type(ctx) != type) {
+            ASTNode::gen_unboxed(ctx, target, type);
+            return;
+        }
+        if (this->folded_.known()) {
+            ctx.int_const(target, this->folded_.value);
+            return;
+        }
+        std::string left = ctx.alloc_int_reg();
+        this->receiver_.gen_unboxed(ctx, left, types::Int);
+        std::string right = ctx.alloc_int_reg();
+        (*this->actuals_.begin())->gen_unboxed(ctx, right, types::Int);
+        ctx.arith(target, int_operator(this->method_.sym_), left, right);
+        ctx.free_reg(left);
+        ctx.free_reg(right);
+    }
+
+    // A comparison of Ints jumps on the comparison itself
+    void Call::gen_branch(CodegenContext &ctx, std::string true_branch, std::string false_branch) {
+        if (this->folded_.known() || this->unboxed_type(ctx) != types::Boolean) {
+            ASTNode::gen_branch(ctx, true_branch, false_branch);
+            return;
+        }
+        std::string left = ctx.alloc_int_reg();
+        this->receiver_.gen_unboxed(ctx, left, types::Int);
+        std::string right = ctx.alloc_int_reg();
+        (*this->actuals_.begin())->gen_unboxed(ctx, right, types::Int);
+        ctx.compare_branch(int_operator(this->method_.sym_), left, right, true_branch, false_branch);
+        ctx.free_reg(left);
+        ctx.free_reg(right);
+    }
+
     void Call::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
-        this->receiver_.gen_rvalue(ctx, target_reg);
-        ctx.emit(target_reg +" -> clazz."+ this->method_.text_ + "("+target_reg+");");
+        if (this->folded_.known()) {
+            gen_constant(ctx, this->folded_, target_reg);
+            return;
+        }
+        TypeId unboxed = this->unboxed_type(ctx);
+        if (unboxed != types::Unset) {
+            std::string value = ctx.alloc_int_reg();
+            this->gen_unboxed(ctx, value, unboxed);
+            ctx.box(target_reg, value, unboxed);
+            ctx.free_reg(value);
+            return;
+        }
+        std::string receiver = ctx.alloc_reg();
+        this->receiver_.gen_rvalue(ctx, receiver);
+        std::vector<std::string> args{receiver};
+        for (Expr *actual: this->actuals_) {
+            std::string arg = ctx.alloc_reg();
+            actual->gen_rvalue(ctx, arg);
+            args.push_back(arg);
+        }
+        Symbol method = this->method_.sym_;
+        const ClassLayout *layout = layout_of(ctx.ss, this->receiver_type_);
+        int slot = layout == nullptr ? common_slot(ctx.ss, method) : layout->slot(method);
+        if (slot <= 0) {
+            ctx.comment("No method " + method.str() + " in " + ctx.ss->type_name(this->receiver_type_).str());
+            ctx.literal(target_reg, "nothing");
+            ctx.free_regs(args);
+            return;
+        }
+        // the classes the receiver can be: its static type's, or else every class with the method there
+        std::vector<TypeId> receivers;
+        if (layout != nullptr) {
+            receivers = ctx.ss->subclasses(this->receiver_type_);
+        } else {
+            for (TypeId clazz = types::Nothing; clazz < (TypeId) ctx.ss->layouts.size(); clazz++) {
+                if (ctx.ss->layouts[clazz].slot(method) == slot) {
+                    receivers.push_back(clazz);
+                }
+            }
+        }
+        ctx.send(target_reg, method, slot, layout == nullptr ? types::Unset : this->receiver_type_, receivers, args);
+        ctx.free_regs(args);
+    }
+
+    void Construct::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
+        std::vector<std::string> args;
+        for (Expr *actual: this->actuals_) {
+            std::string arg = ctx.alloc_reg();
+            actual->gen_rvalue(ctx, arg);
+            args.push_back(arg);
+        }
+        ctx.call(target_reg, "new_" + this->method_.sym_.str(), args);
+        ctx.free_regs(args);
     }
 
     void IntConst::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
-        std::string value = to_string(this->value_);
-        ctx.emit(target_reg + " = (Obj_obj) int_literal(" + value + "); // LOAD constant value");
+        ctx.literal(target_reg, ctx.int_literal(this->value_));
+    }
+
+    void IntConst::gen_unboxed(CodegenContext &ctx, std::string target, TypeId type) {
+        ctx.int_const(target, this->value_);
+    }
+
+    void StrConst::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
+        // the scanner keeps escapes as written, which C reads the same way;
+        // only a triple-quoted string can hold a bare newline or quote
+        std::string literal;
+        for (size_t i = 0; i < this->value_.size(); i++) {
+            char c = this->value_[i];
+            if (c == '\\' && i + 1 < this->value_.size()) {
+                literal += c;
+                literal += this->value_[++i];
+            } else if (c == '"') {
+                literal += "\\\"";
+            } else if (c == '\n') {
+                literal += "\\n";
+            } else if (c == '\r') {
+                literal += "\\r";
+            } else {
+                literal += c;
+            }
+        }
+        ctx.literal(target_reg, ctx.str_literal(literal));
+    }
+
+    /* Boolean operators work on C ints; 'and' and 'or' only evaluate
+     * the right side if they have to.
+     */
+    void And::gen_unboxed(CodegenContext &ctx, std::string target, TypeId type) {
+        if (this->folded_.known()) {
+            ctx.int_const(target, this->folded_.value);
+            return;
+        }
+        if (this->left_.folded_.type == types::Boolean) {
+            // true and x
+            this->right_.gen_unboxed(ctx, target, types::Boolean);
+            return;
+        }
+        std::string right_label = ctx.new_branch_label("and_right");
+        std::string end_label = ctx.new_branch_label("and_end");
+        this->left_.gen_unboxed(ctx, target, types::Boolean);
+        ctx.branch(target, right_label, end_label);
+        ctx.place_label(right_label);
+        this->right_.gen_unboxed(ctx, target, types::Boolean);
+        ctx.place_label(end_label);
+    }
+
+    void Or::gen_unboxed(CodegenContext &ctx, std::string target, TypeId type) {
+        if (this->folded_.known()) {
+            ctx.int_const(target, this->folded_.value);
+            return;
+        }
+        if (this->left_.folded_.type == types::Boolean) {
+            // false or x
+            this->right_.gen_unboxed(ctx, target, types::Boolean);
+            return;
+        }
+        std::string right_label = ctx.new_branch_label("or_right");
+        std::string end_label = ctx.new_branch_label("or_end");
+        this->left_.gen_unboxed(ctx, target, types::Boolean);
+        ctx.branch(target, end_label, right_label);
+        ctx.place_label(right_label);
+        this->right_.gen_unboxed(ctx, target, types::Boolean);
+        ctx.place_label(end_label);
+    }
+
+    void Not::gen_unboxed(CodegenContext &ctx, std::string target, TypeId type) {
+        if (this->folded_.known()) {
+            ctx.int_const(target, this->folded_.value);
+            return;
+        }
+        this->left_.gen_unboxed(ctx, target, types::Boolean);
+        ctx.logical_not(target, target);
+    }
+
+    /* As conditions they need no value at all: each part goes on to
+     * the next part or straight to where the whole goes.
+     */
+    void And::gen_branch(CodegenContext &ctx, std::string true_branch, std::string false_branch) {
+        if (this->folded_.known()) {
+            ASTNode::gen_branch(ctx, true_branch, false_branch);
+            return;
+        }
+        if (this->left_.folded_.type == types::Boolean) {
+            // true and x
+            this->right_.gen_branch(ctx, true_branch, false_branch);
+            return;
+        }
+        std::string right_label = ctx.new_branch_label("and_right");
+        this->left_.gen_branch(ctx, right_label, false_branch);
+        ctx.place_label(right_label);
+        this->right_.gen_branch(ctx, true_branch, false_branch);
+    }
+
+    void Or::gen_branch(CodegenContext &ctx, std::string true_branch, std::string false_branch) {
+        if (this->folded_.known()) {
+            ASTNode::gen_branch(ctx, true_branch, false_branch);
+            return;
+        }
+        if (this->left_.folded_.type == types::Boolean) {
+            // false or x
+            this->right_.gen_branch(ctx, true_branch, false_branch);
+            return;
+        }
+        std::string right_label = ctx.new_branch_label("or_right");
+        this->left_.gen_branch(ctx, true_branch, right_label);
+        ctx.place_label(right_label);
+        this->right_.gen_branch(ctx, true_branch, false_branch);
+    }
+
+    void Not::gen_branch(CodegenContext &ctx, std::string true_branch, std::string false_branch) {
+        if (this->folded_.known()) {
+            ASTNode::gen_branch(ctx, true_branch, false_branch);
+            return;
+        }
+        this->left_.gen_branch(ctx, false_branch, true_branch);
+    }
+
+    void And::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
+        if (this->folded_.known()) {
+            gen_constant(ctx, this->folded_, target_reg);
+            return;
+        }
+        std::string value = ctx.alloc_int_reg();
+        this->gen_unboxed(ctx, value, types::Boolean);
+        ctx.box(target_reg, value, types::Boolean);
+        ctx.free_reg(value);
+    }
+
+    void Or::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
+        if (this->folded_.known()) {
+            gen_constant(ctx, this->folded_, target_reg);
+            return;
+        }
+        std::string value = ctx.alloc_int_reg();
+        this->gen_unboxed(ctx, value, types::Boolean);
+        ctx.box(target_reg, value, types::Boolean);
+        ctx.free_reg(value);
+    }
+
+    void Not::gen_rvalue(CodegenContext &ctx, std::string target_reg) {
+        if (this->folded_.known()) {
+            gen_constant(ctx, this->folded_, target_reg);
+            return;
+        }
+        std::string value = ctx.alloc_int_reg();
+        this->gen_unboxed(ctx, value, types::Boolean);
+        ctx.box(target_reg, value, types::Boolean);
+        ctx.free_reg(value);
     }
 
-}
\ No newline at end of file
+}
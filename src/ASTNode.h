@@ -12,8 +12,13 @@
 #include <set>
 #include <map>
 #include "CodegenContext.h"
+#include "ASTArena.h"
+#include "Symbols.h"
+#include "Types.h"
+#include "Scopes.h"
 
 class StaticSemantics;
+class ClassNode;
 
 namespace AST {
     // Abstract syntax tree.  ASTNode is abstract base class for all other nodes.
@@ -28,6 +33,29 @@ namespace AST {
         void dedent() { --indent_; }
     };
 
+    /* A value worked out at compile time: what constant folding
+     * found an expression to be.
+     */
+    struct Constant {
+        TypeId type = types::Unset;   // Int, Boolean or String; Unset if not a constant
+        long value = 0;               // an Int, or 0 / 1 for a Boolean
+        std::string text;             // a String, as its characters (escapes decoded)
+
+        bool known() const { return type != types::Unset; }
+        static Constant of(TypeId type, long value) {
+            Constant c;
+            c.type = type;
+            c.value = value;
+            return c;
+        }
+        static Constant of_text(std::string text) {
+            Constant c;
+            c.type = types::String;
+            c.text = text;
+            return c;
+        }
+    };
+
     class ASTNode {
     public:
         virtual void json(std::ostream& out, AST_print_context& ctx)=0;  // Json string representation
@@ -37,28 +65,70 @@ namespace AST {
             json(ss, ctx);
             return ss.str();
         }
-        virtual int init_check(StaticSemantics *ss, std::set<std::string> *vars) =0;
+        virtual int init_check(StaticSemantics *ss, ScopedSet *vars) =0;
         virtual std::string get_text() = 0;
-        virtual std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) = 0;
+        /* The name this node denotes, as a symbol (e.g., the variable
+         * assigned to by an Assign).  Interns get_text() unless the
+         * node knows better.
+         */
+        virtual Symbol get_sym() { return Symbol::intern(get_text()); }
+        /* Nodes that are never inferred directly (the program and its
+         * classes run per unit, in StaticSemantics::type_inference)
+         * keep this default.
+         */
+        virtual TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) {
+            return types::Unset;
+        }
+        /* Storing a value of static type 'type' in the location this node
+         * names (the left of an assignment): a variable, unless the node
+         * says otherwise.  The type of the location after, or types::Top.
+         */
+        virtual TypeId type_infer_store(StaticSemantics *ss, TypeEnv* context, TypeId type, Symbol cur_class, Symbol cur_method);
         virtual void gen_rvalue(CodegenContext& ctx, std::string target_reg) {
             std::cout << "*** No rvalue for this node ***" << std::endl;
             //error = true;
             //assert(false);  // Invoke the debugger!
         }
-        /* For the calculator, an lvalue will be the name of a local
-         * variable in the generated C code.  In assembly language,
-         * it would be a register holding the memory address of the
-         * location, which might be calculated in various ways such
-         * as adding an offset to the beginning of an array.
+        /* For a variable, an lvalue is the name of the variable
+         * in the generated code.  Other locations (fields) are not
+         * variables; gen_store puts a value in them.
          */
         virtual std::string gen_lvalue(CodegenContext& ctx) {
             std::cout << "*** No lvalue for this node ***" << std::endl;
             assert(false);
         }
-        virtual void gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch) {
-            std::cout << "*** No branching on this node ****" << std::endl;
+        // Store the object in 'value' in the location this node names
+        virtual void gen_store(CodegenContext& ctx, std::string value) {
+            std::cout << "*** No store to this node ***" << std::endl;
             assert(false);
         }
+        /* Go to true_branch or false_branch on the Boolean this node
+         * computes.  By default we compute it as a C int and test that.
+         */
+        virtual void gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch);
+        /* Int or Boolean if we can compute this node as a plain C int
+         * without making an object, else types::Unset.
+         */
+        virtual TypeId unboxed_type(CodegenContext& ctx) { return types::Unset; }
+        /* Put the value, which has static type 'type' (Int or Boolean),
+         * in the C int 'target'.  By default we make the object and
+         * take the value out of it.
+         */
+        virtual void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type);
+        /* Constant folding runs after the static semantics.  fold folds
+         * the expressions inside this node, then keeps and returns the
+         * value of this one if it is a constant.
+         */
+        Constant folded_;
+        virtual Constant fold() { return folded_; }
+        /* Fold a statement, adding what is left of it to 'statements':
+         * an if with a constant condition leaves only the branch taken,
+         * a loop that never runs leaves nothing.
+         */
+        virtual void fold_into(std::vector<ASTNode *> &statements) {
+            this->fold();
+            statements.push_back(this);
+        }
     protected:
         void json_indent(std::ostream& out, AST_print_context& ctx);
         void json_head(std::string node_kind, std::ostream& out, AST_print_context& ctx);
@@ -71,9 +141,9 @@ namespace AST {
     public:
         explicit Stub(std::string name) : name_{name} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override {return "";};
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override {return types::Unset;};
     };
 
 
@@ -99,6 +169,13 @@ namespace AST {
 
         void append(Kind *el) { elements_.push_back(el); }
 
+        /* Walk the elements in place, e.g., for (Method *m : methods_) */
+        typedef typename std::vector<Kind *>::const_iterator const_iterator;
+        const_iterator begin() const { return elements_.begin(); }
+        const_iterator end() const { return elements_.end(); }
+        size_t size() const { return elements_.size(); }
+        bool empty() const { return elements_.empty(); }
+
         void json(std::ostream &out, AST_print_context &ctx) override {
             json_head(kind_, out, ctx);
             out << "\"elements_\" : [";
@@ -111,15 +188,29 @@ namespace AST {
             out << "]";
             json_close(out, ctx);
         }
-//        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override {
+//        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override {
             //implement here instead of cpp file
             return 0;
         }
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override {
-            return "";
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override {
+            return types::Unset;
         };
+        Constant fold() override {
+            for (Kind *el: elements_) {
+                el->fold();
+            }
+            return folded_;
+        }
+        // For a sequence of statements: fold each, dropping dead ones
+        void fold_statements() {
+            std::vector<ASTNode *> kept;
+            for (Kind *el: elements_) {
+                el->fold_into(kept);
+            }
+            elements_ = kept;
+        }
     };
 
     /* L_Expr nodes are AST nodes that can be evaluated for location.
@@ -147,13 +238,21 @@ namespace AST {
     class Ident : public LExpr {
     public:
 
-        std::string text_;
+        Symbol sym_;
 
-        explicit Ident(std::string txt) : text_{txt} {}
+        explicit Ident(Symbol sym) : sym_{sym} {}
+        explicit Ident(const std::string &txt) : sym_{Symbol::intern(txt)} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override;
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        Symbol get_sym() override { return sym_; }
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        std::string gen_lvalue(CodegenContext& ctx) override;
+        void gen_store(CodegenContext& ctx, std::string value) override;
+        TypeId unboxed_type(CodegenContext& ctx) override;
+        void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override;
     };
 
 
@@ -181,9 +280,9 @@ namespace AST {
         explicit Formal(Ident& var, Ident& type_) :
             var_{var}, type_{type_} {};
         void json(std::ostream& out, AST_print_context&ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
     };
 
     class Formals : public Seq<Formal> {
@@ -203,9 +302,12 @@ namespace AST {
         explicit Method(Ident& name, Formals& formals, ASTNode& returns, Block& statements) :
           name_{name}, formals_{formals}, returns_{returns}, statements_{statements} {}
         void json(std::ostream& out, AST_print_context&ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        // The parameters (this, then the formals) of the function being built
+        void gen_params(CodegenContext& ctx, bool with_this);
     };
 
     class Methods : public Seq<Method> {
@@ -235,9 +337,11 @@ namespace AST {
         explicit Assign(ASTNode &lexpr, ASTNode &rexpr) :
            lexpr_{lexpr}, rexpr_{rexpr} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
     class AssignDeclare : public Assign {
@@ -246,9 +350,9 @@ namespace AST {
         explicit AssignDeclare(ASTNode &lexpr, ASTNode &rexpr, Ident &static_type) :
             Assign(lexpr, rexpr), static_type_{static_type} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
     };
 
     /* A statement could be just an expression ... but
@@ -265,9 +369,16 @@ namespace AST {
     public:
         Load(LExpr &loc) : loc_{loc} {}
         void json(std::ostream &out, AST_print_context &ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override;
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        Symbol get_sym() override { return loc_.get_sym(); }
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        TypeId unboxed_type(CodegenContext& ctx) override { return loc_.unboxed_type(ctx); }
+        void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override {
+            loc_.gen_unboxed(ctx, target, type);
+        }
     };
 
 
@@ -278,9 +389,11 @@ namespace AST {
         ASTNode &expr_;
         explicit Return(ASTNode& expr) : expr_{expr}  {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
     class If : public Statement {
@@ -291,9 +404,12 @@ namespace AST {
         explicit If(ASTNode& cond, Seq<ASTNode>& truepart, Seq<ASTNode>& falsepart) :
             cond_{cond}, truepart_{truepart}, falsepart_{falsepart} { };
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void fold_into(std::vector<ASTNode *> &statements) override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
     class While : public Statement {
@@ -303,9 +419,12 @@ namespace AST {
         explicit While(ASTNode& cond, Block& body) :
             cond_{cond}, body_{body} { };
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void fold_into(std::vector<ASTNode *> &statements) override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
 
@@ -328,9 +447,13 @@ namespace AST {
             name_{name},  super_{super},
             constructor_{constructor}, methods_{methods} {};
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        Constant fold() override;
+        // Just the constructor; context is the table of instance variables
+        TypeId type_infer_constructor(StaticSemantics *ss, TypeEnv* context);
+        // The constructor and the methods
+        void gen_code(CodegenContext& ctx);
     };
 
     /* A Quack program begins with a sequence of zero or more
@@ -346,10 +469,13 @@ namespace AST {
     public:
         explicit IntConst(int v) : value_{v} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
         void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        TypeId unboxed_type(CodegenContext& ctx) override { return types::Int; }
+        void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override;
     };
 
     class Type_Alternative : public ASTNode {
@@ -360,9 +486,12 @@ namespace AST {
         explicit Type_Alternative(Ident& ident, Ident& classname, Block& block) :
                 ident_{ident}, classname_{classname}, block_{block} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        // The alternative for 'value', if its class matches; else go to next_case
+        void gen_case(CodegenContext& ctx, std::string value, std::string next_case, std::string end_case);
     };
 
     class Type_Alternatives : public Seq<Type_Alternative> {
@@ -377,9 +506,11 @@ namespace AST {
         explicit Typecase(Expr& expr, Type_Alternatives& cases) :
                 expr_{expr}, cases_{cases} {};
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
 
@@ -388,9 +519,11 @@ namespace AST {
     public:
         explicit StrConst(std::string v) : value_{v} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
     class Actuals : public Seq<Expr> {
@@ -410,9 +543,11 @@ namespace AST {
         explicit Construct(Ident& method, Actuals& actuals) :
                 method_{method}, actuals_{actuals} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
     };
 
 
@@ -424,17 +559,22 @@ namespace AST {
         Expr& receiver_;        /* Expression computing the receiver object */
         Ident& method_;         /* Identifier of the method */
         Actuals& actuals_;     /* List of actual arguments */
+        TypeId receiver_type_ = types::Unset;  /* Static type of the receiver, from type inference */
     public:
         explicit Call(Expr& receiver, Ident& method, Actuals& actuals) :
                 receiver_{receiver}, method_{method}, actuals_{actuals} {};
         // Convenience factory for the special case of a method
         // created for a binary operator (+, -, etc).
-        static Call* binop(std::string opname, Expr& receiver, Expr& arg);
+        static Call* binop(Arena& arena, Symbol opname, Expr& receiver, Expr& arg);
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
         void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        TypeId unboxed_type(CodegenContext& ctx) override;
+        void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override;
+        void gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch) override;
     };
 
 
@@ -457,18 +597,28 @@ namespace AST {
    public:
        explicit And(ASTNode& left, ASTNode& right) :
           BinOp("And", left, right) {}
-       int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+       int init_check(StaticSemantics *ss, ScopedSet *vars) override;
        std::string get_text() override {return "";};
-       std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+       TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+       Constant fold() override;
+       void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+       TypeId unboxed_type(CodegenContext& ctx) override { return types::Boolean; }
+       void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override;
+       void gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch) override;
    };
 
     class Or : public BinOp {
     public:
         explicit Or(ASTNode& left, ASTNode& right) :
                 BinOp("Or", left, right) {}
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        TypeId unboxed_type(CodegenContext& ctx) override { return types::Boolean; }
+        void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override;
+        void gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch) override;
     };
 
     class Not : public Expr {
@@ -477,9 +627,14 @@ namespace AST {
         explicit Not(ASTNode& left ):
             left_{left}  {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        TypeId unboxed_type(CodegenContext& ctx) override { return types::Boolean; }
+        void gen_unboxed(CodegenContext& ctx, std::string target, TypeId type) override;
+        void gen_branch(CodegenContext& ctx, std::string true_branch, std::string false_branch) override;
     };
 
 
@@ -493,13 +648,22 @@ namespace AST {
     class Dot : public LExpr {
         Expr& left_;
         Ident& right_;
+        Symbol path_ = sym::EMPTY;  // "left.right", interned on first use
+        TypeId left_type_ = types::Unset;  // static type of left, from type inference
+        // the class of left, or nullptr; sets left_type_
+        ClassNode *left_class(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method);
     public:
         explicit Dot (Expr& left, Ident& right) :
            left_{left},  right_{right} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override;
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        Symbol get_sym() override;
+        TypeId type_infer(StaticSemantics *ss, TypeEnv* context, Symbol cur_class, Symbol cur_method) override;
+        TypeId type_infer_store(StaticSemantics *ss, TypeEnv* context, TypeId type, Symbol cur_class, Symbol cur_method) override;
+        Constant fold() override;
+        void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        void gen_store(CodegenContext& ctx, std::string value) override;
     };
 
 
@@ -513,10 +677,14 @@ namespace AST {
         explicit Program(Classes& classes, Block& statements) :
                 classes_{classes}, statements_{statements} {}
         void json(std::ostream& out, AST_print_context& ctx) override;
-        int init_check(StaticSemantics *ss, std::set<std::string> *vars) override;
+        int init_check(StaticSemantics *ss, ScopedSet *vars) override;
         std::string get_text() override {return "";};
-        std::string type_infer(StaticSemantics *ss, std::map<std::string, std::string>* context, std::string cur_class, std::string cur_method) override;
+        Constant fold() override;
+        // Just the statements of the main program
+        TypeId type_infer_statements(StaticSemantics *ss, TypeEnv* context);
         void gen_rvalue(CodegenContext& ctx, std::string target_reg) override;
+        // The IR for the whole program: the classes' functions, then main
+        void gen_program(CodegenContext& ctx);
     };
 
 
@@ -3,6 +3,7 @@
  * (incomplete implementation) 
  * 
  */
+#define _GNU_SOURCE  /* For asprintf */
 #include <stdio.h>
 #include <stdlib.h>  /* Malloc lives here; might replace with gc.h    */
 #include <string.h>  /* For strcpy; might replace with cords.h from gc */
@@ -10,6 +11,273 @@
 #include "Builtins.h"
 
 
+/* ==============
+ * Allocation and garbage collection
+ * ==============
+ */
+
+/* A free block, linked through its first word */
+typedef struct quack_free_cell {
+    struct quack_free_cell *next;
+} quack_free_cell;
+
+#define QUACK_SIZE_CLASSES (QUACK_SMALL_MAX / QUACK_GRANULE + 1)
+
+/* Each thread has its own chunk, free lists and heap, so no locking */
+static _Thread_local char *nursery_next = NULL;
+static _Thread_local char *nursery_limit = NULL;
+static _Thread_local quack_free_cell *free_lists[QUACK_SIZE_CLASSES];
+static _Thread_local quack_header *heap_objects = NULL;
+static _Thread_local size_t bytes_since_gc = 0;
+static _Thread_local size_t live_bytes = 0;
+_Thread_local quack_frame *quack_frames = NULL;
+
+static int gc_stress = -1;   /* -1 until we have looked at the environment */
+
+static size_t quack_round_up(size_t size) {
+    return (size + QUACK_GRANULE - 1) & ~(size_t) (QUACK_GRANULE - 1);
+}
+
+static void out_of_memory(void) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+}
+
+/* Hand a block back: small ones to their free list, big ones to free() */
+static void free_block(void *block, size_t size) {
+    if (size > QUACK_SMALL_MAX) {
+        free(block);
+        return;
+    }
+    quack_free_cell *cell = (quack_free_cell *) block;
+    cell->next = free_lists[size / QUACK_GRANULE];
+    free_lists[size / QUACK_GRANULE] = cell;
+}
+
+/* Start a new chunk.  What is left of the old one goes on a free list. */
+static void nursery_refill(void) {
+    size_t left = (size_t) (nursery_limit - nursery_next);
+    if (nursery_next != NULL && left >= QUACK_GRANULE) {
+        free_block(nursery_next, left < QUACK_SMALL_MAX ? left : QUACK_SMALL_MAX);
+    }
+    nursery_next = malloc(QUACK_CHUNK_SIZE);
+    if (nursery_next == NULL) {
+        out_of_memory();
+    }
+    nursery_limit = nursery_next + QUACK_CHUNK_SIZE;
+}
+
+/* ---- Type descriptors, found by class ---- */
+
+#define QUACK_TYPE_TABLE 1024   /* a power of two */
+static const quack_type *type_table[QUACK_TYPE_TABLE];
+static int builtin_types_registered = 0;
+static void register_builtin_types(void);   /* at the end of this file */
+
+static size_t type_slot(class_Obj clazz) {
+    return ((size_t) clazz >> 4) & (QUACK_TYPE_TABLE - 1);
+}
+
+void quack_register_type(const quack_type *type) {
+    size_t slot = type_slot(type->clazz);
+    for (size_t probes = 0; probes < QUACK_TYPE_TABLE; probes++) {
+        if (type_table[slot] == NULL || type_table[slot]->clazz == type->clazz) {
+            type_table[slot] = type;
+            return;
+        }
+        slot = (slot + 1) & (QUACK_TYPE_TABLE - 1);
+    }
+    fprintf(stderr, "Too many classes\n");
+    exit(1);
+}
+
+static const quack_type *type_of(obj_Obj obj) {
+    size_t slot = type_slot(obj->clazz);
+    while (type_table[slot] != NULL) {
+        if (type_table[slot]->clazz == obj->clazz) {
+            return type_table[slot];
+        }
+        slot = (slot + 1) & (QUACK_TYPE_TABLE - 1);
+    }
+    return NULL;
+}
+
+/* An object that holds memory outside the heap; its type's
+ * finalize will release it when the object dies.
+ */
+static void finalize_later(obj_Obj obj) {
+    HEADER_OF(obj)->finalize = 1;
+}
+
+/* ---- Mark and sweep ---- */
+
+static _Thread_local obj_Obj *mark_stack = NULL;
+static _Thread_local size_t mark_top = 0;
+static _Thread_local size_t mark_capacity = 0;
+
+static void mark_push(obj_Obj obj) {
+    if (obj == NULL) {
+        return;
+    }
+    if (mark_top == mark_capacity) {
+        mark_capacity = mark_capacity ? 2 * mark_capacity : 1024;
+        mark_stack = realloc(mark_stack, mark_capacity * sizeof(obj_Obj));
+        if (mark_stack == NULL) {
+            out_of_memory();
+        }
+    }
+    mark_stack[mark_top++] = obj;
+}
+
+/* Mark everything reachable from the pushed objects; an explicit
+ * stack, so a long list does not overflow the C stack.
+ */
+static void mark_all(void) {
+    while (mark_top > 0) {
+        obj_Obj obj = mark_stack[--mark_top];
+        const quack_type *type = type_of(obj);
+        if (type != NULL && type->static_only) {
+            continue;
+        }
+        quack_header *header = HEADER_OF(obj);
+        if (header->marked) {
+            continue;
+        }
+        header->marked = 1;
+        if (type == NULL) {
+            continue;
+        }
+        for (int i = 0; i < type->n_pointers; i++) {
+            mark_push(*(obj_Obj *) ((char *) obj + type->offsets[i]));
+        }
+    }
+}
+
+void quack_collect(void) {
+    for (quack_frame *frame = quack_frames; frame != NULL; frame = frame->prev) {
+        for (int i = 0; i < frame->n_roots; i++) {
+            mark_push(*frame->roots[i]);
+        }
+    }
+    mark_all();
+    quack_header **link = &heap_objects;
+    live_bytes = 0;
+    while (*link != NULL) {
+        quack_header *header = *link;
+        if (header->marked) {
+            header->marked = 0;
+            live_bytes += header->size;
+            link = &header->next;
+        } else {
+            *link = header->next;
+            if (header->finalize) {
+                obj_Obj obj = (obj_Obj) (header + 1);
+                type_of(obj)->finalize(obj);
+            }
+            free_block(header, header->size);
+        }
+    }
+    bytes_since_gc = 0;
+}
+
+obj_Obj quack_alloc(size_t size, class_Obj clazz) {
+    if (!builtin_types_registered) {
+        register_builtin_types();
+    }
+    if (gc_stress < 0) {
+        gc_stress = getenv("QUACK_GC_STRESS") != NULL;
+    }
+    size_t threshold = live_bytes > QUACK_GC_MIN_HEAP ? live_bytes : QUACK_GC_MIN_HEAP;
+    if (gc_stress || bytes_since_gc > threshold) {
+        quack_collect();
+    }
+    quack_header *header;
+    size = quack_round_up(size + sizeof(quack_header));
+    if (size > QUACK_SMALL_MAX) {
+        header = (quack_header *) malloc(size);
+        if (header == NULL) {
+            out_of_memory();
+        }
+    } else {
+        quack_free_cell **list = &free_lists[size / QUACK_GRANULE];
+        if (*list != NULL) {
+            header = (quack_header *) *list;
+            *list = (*list)->next;
+        } else {
+            if ((size_t) (nursery_limit - nursery_next) < size) {
+                nursery_refill();
+            }
+            header = (quack_header *) nursery_next;
+            nursery_next += size;
+        }
+    }
+    /* Zeroed, so the collector never sees a field that was not set yet */
+    memset(header, 0, size);
+    header->size = (unsigned) size;
+    header->next = heap_objects;
+    heap_objects = header;
+    bytes_since_gc += size;
+    obj_Obj obj = (obj_Obj) (header + 1);
+    obj->clazz = clazz;
+    return obj;
+}
+
+static obj_String str_adopt(char *s);   /* with String, below */
+
+
+/* ==============
+ * Output
+ * PRINT goes to a per-thread buffer, written to stdout when it
+ * fills up and when the program exits, so printing a line is a
+ * memcpy rather than a locked stdio call.
+ * ==============
+ */
+static _Thread_local char out_buffer[QUACK_OUT_SIZE];
+static _Thread_local size_t out_used = 0;
+static _Thread_local int out_registered = 0;
+
+void quack_flush(void) {
+    if (out_used > 0) {
+        fwrite(out_buffer, 1, out_used, stdout);
+        out_used = 0;
+    }
+    fflush(stdout);
+}
+
+static void out_bytes(const char *bytes, size_t n) {
+    if (!out_registered) {
+        out_registered = 1;
+        atexit(quack_flush);
+    }
+    if (out_used + n > QUACK_OUT_SIZE) {
+        quack_flush();
+        if (n > QUACK_OUT_SIZE) {
+            /* Too big to be worth copying */
+            fwrite(bytes, 1, n, stdout);
+            return;
+        }
+    }
+    memcpy(out_buffer + out_used, bytes, n);
+    out_used += n;
+}
+
+/* The decimal digits of n, at the end of buf (at least 12 chars);
+ * returns where they start
+ */
+static char *format_int(char *buf_end, int n) {
+    unsigned int magnitude = n < 0 ? 0u - (unsigned int) n : (unsigned int) n;
+    char *p = buf_end;
+    do {
+        *--p = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (n < 0) {
+        *--p = '-';
+    }
+    return p;
+}
+
+
 /* ==============
  * Obj 
  * Fields: None
@@ -26,9 +294,7 @@ class_Obj the_class_Obj;
 
 /* Constructor */
 obj_Obj new_Obj(  ) {
-    obj_Obj new_thing = (obj_Obj) malloc(sizeof(struct obj_Obj_struct));
-    new_thing->clazz = the_class_Obj;
-    return new_thing;
+    return quack_alloc(sizeof(struct obj_Obj_struct), the_class_Obj);
 }
 
 /* Obj:STRING */
@@ -36,7 +302,7 @@ obj_String Obj_method_STRING(obj_Obj this) {
     long addr = (long) this;
     char *rep;
     asprintf(&rep, "<Object at %ld>", addr);
-    obj_String str = str_literal(rep);
+    obj_String str = str_adopt(rep);
     return str;
 }
 
@@ -45,7 +311,7 @@ obj_String Obj_method_STRING(obj_Obj this) {
 /* Obj:PRINT */
 obj_Obj Obj_method_PRINT(obj_Obj this) {
     obj_String str = this->clazz->STRING(this);
-    fprintf(stdout, "%s", str->text);
+    out_bytes(str_text(str), str->length);
     return this;
 }
 
@@ -72,20 +338,109 @@ class_Obj the_class_Obj = &the_class_Obj_struct;
 
 /* ================
  * String
- * Fields: 
- *    One hidden field, currently holding char*
- *    (change later to a rope for garbage collection)
- * Methods: 
- *    Those of Obj, plus ordering, concatenation 
- *    (Incomplete for now.)
+ * Fields:
+ *    Hidden fields only; a rope (see Builtins.h).
+ *    Concatenation just makes a node pointing to both
+ *    sides, so building a long string piece by piece is
+ *    linear.  The bytes are put together (once) when
+ *    PRINT, EQUALS or LESS needs them.
+ * Methods:
+ *    Those of Obj, plus ordering, concatenation
  * ==================
  */
 
+/* Concatenations shorter than this are copied right away
+ * rather than making a node; a node costs more than the copy.
+ */
+#define ROPE_FLAT_MAX 32
+
 /* Constructor */
 obj_String new_String(  ) {
-    obj_String new_thing = (obj_String) malloc(sizeof(struct obj_String_struct));
-    new_thing->clazz = the_class_String;
-    return new_thing;
+    obj_String str = (obj_String) quack_alloc(sizeof(struct obj_String_struct), (class_Obj) the_class_String);
+    str->text = "";
+    return str;
+}
+
+/* A string holding malloc'd text, which it frees when it dies */
+static obj_String str_adopt(char *s) {
+    obj_String str = str_literal(s);
+    str->owns_text = 1;
+    finalize_later((obj_Obj) str);
+    return str;
+}
+
+/* Copy the leaves of a concatenation, left to right, into one
+ * buffer.  Ropes built by a loop are as deep as the loop is long,
+ * so we walk them with an explicit stack rather than recursion.
+ */
+static void str_flatten(obj_String str) {
+    char *buf = malloc(str->length + 1);
+    size_t capacity = 64, top = 0;
+    obj_String *stack = malloc(capacity * sizeof(obj_String));
+    if (buf == NULL || stack == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    long pos = 0;
+    stack[top++] = str;
+    while (top > 0) {
+        obj_String node = stack[--top];
+        if (node->text != NULL) {
+            memcpy(buf + pos, node->text, node->length);
+            pos += node->length;
+            continue;
+        }
+        if (top + 2 > capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(obj_String));
+            if (stack == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+        }
+        stack[top++] = node->right;
+        stack[top++] = node->left;
+    }
+    free(stack);
+    buf[pos] = '\0';
+    str->text = buf;
+    str->owns_text = 1;
+    /* The pieces are no longer needed by this string */
+    str->left = NULL;
+    str->right = NULL;
+    finalize_later((obj_Obj) str);
+}
+
+char *str_text(obj_String s) {
+    if (s->text == NULL) {
+        str_flatten(s);
+    }
+    return s->text;
+}
+
+long str_length(obj_String s) {
+    return s->length;
+}
+
+/* FNV-1a, computed once */
+unsigned long str_hash(obj_String s) {
+    if (s->hash == 0) {
+        unsigned long h = 14695981039346656037UL;
+        char *text = str_text(s);
+        for (long i = 0; i < s->length; i++) {
+            h = (h ^ (unsigned char) text[i]) * 1099511628211UL;
+        }
+        s->hash = h ? h : 1;
+    }
+    return s->hash;
+}
+
+/* Releases the text of a dead string */
+static void String_finalize(obj_Obj obj) {
+    obj_String str = (obj_String) obj;
+    if (str->owns_text) {
+        free(str->text);
+    }
 }
 
 /* String:STRING */
@@ -95,7 +450,7 @@ obj_String String_method_STRING(obj_String this) {
 
 /* String:PRINT */
 obj_String String_method_PRINT(obj_String this) {
-    fprintf(stdout, "%s", this->text);
+    out_bytes(str_text(this), this->length);
     return this;
 }
 
@@ -106,31 +461,70 @@ obj_Boolean String_method_EQUALS(obj_String this, obj_Obj other) {
     if (other_str->clazz != the_class_String) {
         return lit_false;
     }
-    if (strcmp(this->text,other_str->text) == 0) {
+    if (this->length != other_str->length || str_hash(this) != str_hash(other_str)) {
+        return lit_false;
+    }
+    if (memcmp(str_text(this), str_text(other_str), this->length) == 0) {
         return lit_true;
     } else {
         return lit_false;
     }
 }
 
+/* String:LESS (ordering) */
+obj_Boolean String_method_LESS(obj_String this, obj_String other) {
+    long shorter = this->length < other->length ? this->length : other->length;
+    int order = memcmp(str_text(this), str_text(other), shorter);
+    if (order < 0 || (order == 0 && this->length < other->length)) {
+        return lit_true;
+    }
+    return lit_false;
+}
+
+/* String:PLUS (concatenation) */
+obj_String String_method_PLUS(obj_String this, obj_String other) {
+    if (other->length == 0) {
+        return this;
+    }
+    if (this->length == 0) {
+        return other;
+    }
+    long length = this->length + other->length;
+    if (length < ROPE_FLAT_MAX && this->text != NULL && other->text != NULL) {
+        char *rep = malloc(length + 1);
+        memcpy(rep, this->text, this->length);
+        memcpy(rep + this->length, other->text, other->length + 1);
+        return str_adopt(rep);
+    }
+    obj_String str = the_class_String->constructor();
+    str->text = NULL;
+    str->left = this;
+    str->right = other;
+    str->length = length;
+    return str;
+}
+
 /* The String Class (a singleton) */
 struct  class_String_struct  the_class_String_struct = {
         new_String,     /* Constructor */
         String_method_STRING,
         String_method_PRINT,
-        String_method_EQUALS
+        String_method_EQUALS,
+        String_method_LESS,
+        String_method_PLUS
 };
 
 class_String the_class_String = &the_class_String_struct;
 
 /* 
  * Internal use function for creating String objects
- * from char*.  Use this to create string literals. 
+ * from char*.  Use this to create string literals;
+ * the text is not copied, and not freed.
  */
 obj_String str_literal(char *s) {
-    char *rep;
     obj_String str = the_class_String->constructor();
     str->text = s;
+    str->length = strlen(s);
     return str;
 }
 
@@ -144,10 +538,7 @@ obj_String str_literal(char *s) {
  */
 /* Constructor */
 obj_Boolean new_Boolean(  ) {
-    obj_Boolean new_thing = (obj_Boolean)
-            malloc(sizeof(struct obj_Boolean_struct));
-    new_thing->clazz = the_class_Boolean;
-    return new_thing;
+    return lit_false;
 }
 
 /* Boolean:STRING */
@@ -249,17 +640,28 @@ obj_Nothing nothing = &nothing_struct;
 /* Constructor */
 obj_Int new_Int(  ) {
     obj_Int new_thing = (obj_Int)
-            malloc(sizeof(struct obj_Int_struct));
-    new_thing->clazz = the_class_Int;
+            quack_alloc(sizeof(struct obj_Int_struct), (class_Obj) the_class_Int);
     new_thing->value = 0;
     return new_thing;
 }
 
 /* Int:STRING */
 obj_String Int_method_STRING(obj_Int this) {
-    char *rep;
-    asprintf(&rep, "%d", this->value);
-    return str_literal(rep);
+    char digits[12];
+    char *start = format_int(digits + sizeof digits, this->value);
+    size_t length = digits + sizeof digits - start;
+    char *rep = malloc(length + 1);
+    memcpy(rep, start, length);
+    rep[length] = '\0';
+    return str_adopt(rep);
+}
+
+/* Int:PRINT, straight into the output buffer */
+obj_Obj Int_method_PRINT(obj_Obj this) {
+    char digits[12];
+    char *start = format_int(digits + sizeof digits, ((obj_Int) this)->value);
+    out_bytes(start, digits + sizeof digits - start);
+    return this;
 }
 
 /* Int:EQUALS */
@@ -290,25 +692,114 @@ obj_Int Int_method_PLUS(obj_Int this, obj_Int other) {
     return int_literal(this->value + other->value);
 }
 
+/* MINUS, TIMES, DIVIDE (new methods) */
+obj_Int Int_method_MINUS(obj_Int this, obj_Int other) {
+    return int_literal(this->value - other->value);
+}
+
+obj_Int Int_method_TIMES(obj_Int this, obj_Int other) {
+    return int_literal(this->value * other->value);
+}
+
+obj_Int Int_method_DIVIDE(obj_Int this, obj_Int other) {
+    return int_literal(this->value / other->value);
+}
+
+/* MORE, ATLEAST, ATMOST (new methods) */
+obj_Boolean Int_method_MORE(obj_Int this, obj_Int other) {
+    if (this->value > other->value) {
+        return lit_true;
+    }
+    return lit_false;
+}
+
+obj_Boolean Int_method_ATLEAST(obj_Int this, obj_Int other) {
+    if (this->value >= other->value) {
+        return lit_true;
+    }
+    return lit_false;
+}
+
+obj_Boolean Int_method_ATMOST(obj_Int this, obj_Int other) {
+    if (this->value <= other->value) {
+        return lit_true;
+    }
+    return lit_false;
+}
+
 /* The Int Class (a singleton) */
 struct  class_Int_struct  the_class_Int_struct = {
         new_Int,     /* Constructor */
         Int_method_STRING,
-        Obj_method_PRINT,
+        Int_method_PRINT,
         Int_method_EQUALS,
         Int_method_LESS,
-        Int_method_PLUS
+        Int_method_PLUS,
+        Int_method_MINUS,
+        Int_method_TIMES,
+        Int_method_DIVIDE,
+        Int_method_MORE,
+        Int_method_ATLEAST,
+        Int_method_ATMOST
 };
 
 class_Int the_class_Int = &the_class_Int_struct;
 
+/* Boxes for the small ints, made the first time they are wanted */
+static quack_static_Int small_ints[QUACK_SMALL_INT_MAX - QUACK_SMALL_INT_MIN + 1];
+
 /* Integer literals constructor, 
  * used by compiler and not otherwise available in 
- * Quack programs. 
+ * Quack programs.  Small ints come from a table
+ * instead of the heap; Ints are never changed, so they
+ * can be shared.
  */
 obj_Int int_literal(int n) {
+    if (n >= QUACK_SMALL_INT_MIN && n <= QUACK_SMALL_INT_MAX) {
+        quack_static_Int *cached = &small_ints[n - QUACK_SMALL_INT_MIN];
+        if (cached->obj.clazz == NULL) {
+            cached->header.marked = 1;
+            cached->obj.value = n;
+            cached->obj.clazz = &the_class_Int_struct;
+        }
+        return &cached->obj;
+    }
     obj_Int boxed = new_Int();
     boxed->value = n;
     return boxed;
 }
 
+
+/* ==============
+ * Type descriptors of the built-in classes.
+ * Only a String refers to other objects, the two sides of a
+ * concatenation; its text is malloc'd, and freed by String_finalize.
+ * Boolean and Nothing have only their static instances (the Boolean
+ * constructor returns lit_false).
+ * ==============
+ */
+static const size_t the_type_String_offsets[] = {
+        offsetof(struct obj_String_struct, left),
+        offsetof(struct obj_String_struct, right)
+};
+
+static const quack_type the_type_Obj =
+        { &the_class_Obj_struct, "Obj", sizeof(struct obj_Obj_struct), 0, 0, NULL, NULL };
+static const quack_type the_type_String =
+        { (class_Obj) &the_class_String_struct, "String", sizeof(struct obj_String_struct), 0, 2,
+          the_type_String_offsets, String_finalize };
+static const quack_type the_type_Int =
+        { (class_Obj) &the_class_Int_struct, "Int", sizeof(struct obj_Int_struct), 0, 0, NULL, NULL };
+static const quack_type the_type_Boolean =
+        { (class_Obj) &the_class_Boolean_struct, "Boolean", sizeof(struct obj_Boolean_struct), 1, 0, NULL, NULL };
+static const quack_type the_type_Nothing =
+        { (class_Obj) &the_class_Nothing_struct, "Nothing", sizeof(struct obj_Nothing_struct), 1, 0, NULL, NULL };
+
+static void register_builtin_types(void) {
+    builtin_types_registered = 1;
+    quack_register_type(&the_type_Obj);
+    quack_register_type(&the_type_String);
+    quack_register_type(&the_type_Int);
+    quack_register_type(&the_type_Boolean);
+    quack_register_type(&the_type_Nothing);
+}
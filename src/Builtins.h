@@ -31,6 +31,19 @@
  * in Quack but an explicit argument in the runtime.
  */
 
+/* Compiled code does not call methods by these field names.  Every
+ * class structure is nothing but a packed table of function pointers,
+ * and a subclass's table starts with the slots of its superclass in
+ * the same order (see ClassLayout in the compiler), so method number k
+ * of any object is one indexed load away:
+ *     ((obj_Obj (*)(obj_Obj, ...)) VTABLE(obj)[k])(obj, ...)
+ * The compiler emits the tables of user classes as static arrays of
+ * vmethod; the tables below must keep their order in step with the
+ * built-in layouts in staticsemantics.cpp.
+ */
+typedef void (*vmethod)(void);
+#define VTABLE(obj) ((vmethod *) ((obj_Obj) (obj))->clazz)
+
 /* The following object types are "known" from Obj, in the
  * sense that there are Obj methods that return these types.
  */
@@ -69,14 +82,90 @@ struct class_Obj_struct {
 
 extern class_Obj the_class_Obj; /* Initialized in Builtins.c */
 
+/* ==============
+ * Allocation and garbage collection
+ *
+ * Every object, built-in or compiled, comes from quack_alloc,
+ * which also installs its class.  Small objects are carved from
+ * a per-thread chunk by bumping a pointer, or reused from a free
+ * list for their size; anything bigger goes to malloc.
+ *
+ * The collector is a precise mark-sweep collector.  Roots are the
+ * object variables of the active compiled functions: each function
+ * pushes a quack_frame with their addresses on a shadow stack when
+ * it starts and pops it when it returns.  Objects are traced through
+ * type descriptors, one per class, that say where its fields are;
+ * the compiler emits them for user classes from the class layouts.
+ * Setting QUACK_GC_STRESS in the environment collects on every
+ * allocation, for testing.
+ * ==============
+ */
+#include <stddef.h>
+
+#define QUACK_GRANULE 8                /* sizes are rounded up to this */
+#define QUACK_SMALL_MAX 256            /* bigger objects come from malloc */
+#define QUACK_CHUNK_SIZE (64 * 1024)   /* bytes the nursery grabs at a time */
+#define QUACK_GC_MIN_HEAP (1024 * 1024) /* allocate at least this much between collections */
+
+/* Every object is preceded by a header.  The headers link all
+ * the heap objects of a thread, which is what the sweep walks.
+ * An object outside the heap (a literal in the data segment, a
+ * cached small int) has a header that is always marked, so the
+ * collector neither traces it nor frees it.
+ */
+typedef struct quack_header {
+    struct quack_header *next;
+    unsigned size;          /* bytes in the block, header included */
+    unsigned short marked;
+    unsigned short finalize;   /* call its type's finalize when it dies */
+} quack_header;
+
+#define HEADER_OF(obj) (((quack_header *) (obj)) - 1)
+#define QUACK_STATIC_HEADER { NULL, 0, 1, 0 }
+
+typedef struct quack_type {
+    class_Obj clazz;        /* objects of this type have this class */
+    const char *name;
+    size_t size;            /* bytes in an object */
+    int static_only;        /* all instances are static (lit_true, nothing), never traced */
+    int n_pointers;         /* fields that refer to other objects ... */
+    const size_t *offsets;  /* ... and where they are */
+    void (*finalize)(obj_Obj);  /* releases what a dead object holds outside the heap, or NULL */
+} quack_type;
+
+/* Compiled programs register the types of their classes before they run */
+void quack_register_type(const quack_type *type);
+
+typedef struct quack_frame {
+    struct quack_frame *prev;
+    int n_roots;
+    obj_Obj **roots;        /* addresses of the function's object variables */
+} quack_frame;
+
+extern _Thread_local quack_frame *quack_frames;   /* innermost frame */
+
+obj_Obj quack_alloc(size_t size, class_Obj clazz);
+void quack_collect(void);
+
+/* ================
+ * Output
+ * PRINT output is buffered per thread; this writes it out.
+ * It runs by itself at exit.
+ * ================
+ */
+#define QUACK_OUT_SIZE (64 * 1024)
+
+void quack_flush(void);
+
 /* ================
  * String
  * Fields:
- *    One hidden field, currently holding char*
- *    (change later to a rope for garbage collection)
+ *    Hidden fields only.  A String is a rope: either flat
+ *    (its own NUL-terminated text) or the concatenation of
+ *    two other Strings, flattened the first time something
+ *    needs its bytes.  Length and hash are kept with it.
  * Methods:
  *    Those of Obj, plus ordering, concatenation
- *    (Incomplete for now.)
  * ==================
  */
 
@@ -85,7 +174,12 @@ typedef struct class_String_struct* class_String;
 
 typedef struct obj_String_struct {
     class_String clazz;
-    char *text;     /* FIXME: Make this a garbage-collectable rope */
+    struct obj_String_struct *left;    /* a concatenation is left + right ... */
+    struct obj_String_struct *right;   /* ... both NULL once it is flat */
+    char *text;             /* NULL until a concatenation is flattened */
+    long length;
+    unsigned long hash;     /* 0 until someone asks for it */
+    int owns_text;          /* text was malloc'd for this string */
 } * obj_String;
 
 struct class_String_struct {
@@ -96,10 +190,17 @@ struct class_String_struct {
     obj_Boolean (*EQUALS) (obj_String, obj_Obj);
     /* Method table: Introduced in String */
     obj_Boolean (*LESS) (obj_String, obj_String);
+    obj_String (*PLUS) (obj_String, obj_String);   /* Concatenation */
 };
 
 extern class_String the_class_String;
 
+/* A String laid out by the compiler in the data segment */
+typedef struct {
+    quack_header header;
+    struct obj_String_struct obj;
+} quack_static_String;
+
 /* Construct an object from a string literal.
  * This is not available to the Quack programmer, but
  * is used by the compiler to create a literal string
@@ -107,6 +208,11 @@ extern class_String the_class_String;
  */
 extern obj_String str_literal(char *s);
 
+/* The bytes of a string (flattening it if need be), its length, its hash */
+extern char *str_text(obj_String s);
+extern long str_length(obj_String s);
+extern unsigned long str_hash(obj_String s);
+
 /* ================
  * Boolean
  * Fields:
@@ -190,9 +296,8 @@ extern obj_Nothing nothing;
  *    PRINT   (inherit)
  *    EQUALS  (override)
  *    and introducing
- *    LESS
- *    PLUS
- *    (add more later)
+ *    LESS, PLUS, MINUS, TIMES, DIVIDE,
+ *    MORE, ATLEAST, ATMOST
  * =================
  */
 
@@ -208,14 +313,31 @@ struct class_Int_struct {
     /* Method table: Inherited or overridden */
     obj_Int (*constructor) ( void );
     obj_String (*STRING) (obj_Int);  /* Overridden */
-    obj_Obj (*PRINT) (obj_Obj);      /* Inherited */
+    obj_Obj (*PRINT) (obj_Obj);      /* Overridden */
     obj_Boolean (*EQUALS) (obj_Int, obj_Obj); /* Overridden */
     obj_Boolean (*LESS) (obj_Int, obj_Int);   /* Introduced */
     obj_Int (*PLUS) (obj_Int, obj_Int);       /* Introduced */
+    obj_Int (*MINUS) (obj_Int, obj_Int);      /* Introduced */
+    obj_Int (*TIMES) (obj_Int, obj_Int);      /* Introduced */
+    obj_Int (*DIVIDE) (obj_Int, obj_Int);     /* Introduced */
+    obj_Boolean (*MORE) (obj_Int, obj_Int);   /* Introduced */
+    obj_Boolean (*ATLEAST) (obj_Int, obj_Int); /* Introduced */
+    obj_Boolean (*ATMOST) (obj_Int, obj_Int); /* Introduced */
 };
 
 extern class_Int the_class_Int;
 
+/* An Int outside the heap: a literal laid out by the compiler,
+ * or one of the small ints int_literal hands out
+ */
+typedef struct {
+    quack_header header;
+    struct obj_Int_struct obj;
+} quack_static_Int;
+
+#define QUACK_SMALL_INT_MIN (-128)
+#define QUACK_SMALL_INT_MAX 1023
+
 /* Integer literals constructor,
  * used by compiler and not otherwise available in
  * Quack programs.
@@ -234,11 +356,20 @@ obj_Boolean Obj_method_EQUALS(obj_Obj this, obj_Obj other);
 obj_String String_method_STRING(obj_String this);
 obj_String String_method_PRINT(obj_String this);
 obj_Boolean String_method_EQUALS(obj_String this, obj_Obj other);
+obj_Boolean String_method_LESS(obj_String this, obj_String other);
+obj_String String_method_PLUS(obj_String this, obj_String other);
 obj_String Boolean_method_STRING(obj_Boolean this);
 obj_String Nothing_method_STRING(obj_Nothing this);
 obj_String Int_method_STRING(obj_Int this);
+obj_Obj Int_method_PRINT(obj_Obj this);
 obj_Boolean Int_method_EQUALS(obj_Int this, obj_Obj other);
 obj_Boolean Int_method_LESS(obj_Int this, obj_Int other);
 obj_Int Int_method_PLUS(obj_Int this, obj_Int other);
+obj_Int Int_method_MINUS(obj_Int this, obj_Int other);
+obj_Int Int_method_TIMES(obj_Int this, obj_Int other);
+obj_Int Int_method_DIVIDE(obj_Int this, obj_Int other);
+obj_Boolean Int_method_MORE(obj_Int this, obj_Int other);
+obj_Boolean Int_method_ATLEAST(obj_Int this, obj_Int other);
+obj_Boolean Int_method_ATMOST(obj_Int this, obj_Int other);
 
 #endif
@@ -0,0 +1,403 @@
+//
+// The C backend (see CBackend.h)
+//
+
+#include <cassert>
+#include <map>
+#include <set>
+#include "CBackend.h"
+#include "staticsemantics.cpp"
+
+/* A call site whose receiver can be at most this many classes tests
+ * for each of them and calls its method directly; with more, it goes
+ * through the method table.  There is no per-site cache: with no
+ * class known ahead, checking one costs more than the indexed load.
+ */
+static const size_t MAX_TESTED_CLASSES = 4;
+
+// C parameter types of a function taking 'arity' arguments (and maybe the receiver)
+static std::string param_types(size_t arity, bool with_this) {
+    std::string params = with_this ? "obj_Obj" : "";
+    for (size_t i = 0; i < arity; i++) {
+        params += std::string(params.empty() ? "" : ", ") + "obj_Obj";
+    }
+    return "(" + (params.empty() ? std::string("void") : params) + ")";
+}
+
+// C type of a method that takes 'arity' arguments besides the receiver
+static std::string method_type(size_t arity) {
+    return "obj_Obj (*)" + param_types(arity, true);
+}
+
+// C expression for the method table of a class
+static std::string vtable_of(StaticSemantics *ss, TypeId clazz) {
+    const ClassLayout &layout = ss->layouts[clazz];
+    if (layout.builtin) {
+        return "(vmethod *) the_class_" + layout.name.str();
+    }
+    return "(vmethod *) the_class_" + layout.name.str() + "_vtable";
+}
+
+static std::string join(const std::vector<std::string> &items) {
+    std::string joined;
+    for (const std::string &item : items) {
+        joined += std::string(joined.empty() ? "" : ", ") + item;
+    }
+    return joined;
+}
+
+/* The prototypes of the built-in methods in Builtins.h: the result
+ * type, then the types of the receiver and the arguments.
+ */
+static const std::map<std::string, std::vector<std::string>> builtin_prototypes = {
+        {"Obj_method_STRING",     {"obj_String", "obj_Obj"}},
+        {"Obj_method_PRINT",      {"obj_Obj", "obj_Obj"}},
+        {"Obj_method_EQUALS",     {"obj_Boolean", "obj_Obj", "obj_Obj"}},
+        {"String_method_STRING",  {"obj_String", "obj_String"}},
+        {"String_method_PRINT",   {"obj_String", "obj_String"}},
+        {"String_method_EQUALS",  {"obj_Boolean", "obj_String", "obj_Obj"}},
+        {"String_method_LESS",    {"obj_Boolean", "obj_String", "obj_String"}},
+        {"String_method_PLUS",    {"obj_String", "obj_String", "obj_String"}},
+        {"Boolean_method_STRING", {"obj_String", "obj_Boolean"}},
+        {"Nothing_method_STRING", {"obj_String", "obj_Nothing"}},
+        {"Int_method_STRING",     {"obj_String", "obj_Int"}},
+        {"Int_method_PRINT",      {"obj_Obj", "obj_Obj"}},
+        {"Int_method_EQUALS",     {"obj_Boolean", "obj_Int", "obj_Obj"}},
+        {"Int_method_LESS",       {"obj_Boolean", "obj_Int", "obj_Int"}},
+        {"Int_method_PLUS",       {"obj_Int", "obj_Int", "obj_Int"}},
+        {"Int_method_MINUS",      {"obj_Int", "obj_Int", "obj_Int"}},
+        {"Int_method_TIMES",      {"obj_Int", "obj_Int", "obj_Int"}},
+        {"Int_method_DIVIDE",     {"obj_Int", "obj_Int", "obj_Int"}},
+        {"Int_method_MORE",       {"obj_Boolean", "obj_Int", "obj_Int"}},
+        {"Int_method_ATLEAST",    {"obj_Boolean", "obj_Int", "obj_Int"}},
+        {"Int_method_ATMOST",     {"obj_Boolean", "obj_Int", "obj_Int"}},
+};
+
+/* A call to a known method.  User methods take and return obj_Obj;
+ * a built-in one is called through its own prototype, with the
+ * arguments and the result cast, as C requires.
+ */
+static std::string direct_call(const std::string &impl, const std::vector<std::string> &args) {
+    auto builtin = builtin_prototypes.find(impl);
+    if (builtin == builtin_prototypes.end()) {
+        return impl + "(" + join(args) + ")";
+    }
+    const std::vector<std::string> &types = builtin->second;
+    assert(types.size() == args.size() + 1);
+    std::vector<std::string> cast;
+    for (size_t i = 0; i < args.size(); i++) {
+        cast.push_back("(" + types[i + 1] + ") " + args[i]);
+    }
+    return "(obj_Obj) " + impl + "(" + join(cast) + ")";
+}
+
+void CBackend::gen_module(const ir::Module &module) {
+    std::string prologue;
+    section = &prologue;
+    emit("#include <stdio.h>");
+    emit("#include <stdlib.h>");
+    emit("#include \"Builtins.c\"");
+    // every class's functions are declared before any table or code mentions them
+    for (TypeId clazz : module.classes) {
+        gen_declarations(clazz, module);
+    }
+    for (TypeId clazz : module.classes) {
+        gen_vtable(clazz);
+        gen_type_descriptor(clazz);
+    }
+    std::string pool;
+    section = &pool;
+    gen_literals(module);
+    std::vector<std::string> functions(module.functions.size());
+    for (size_t i = 0; i < module.functions.size(); i++) {
+        gen_function(module.functions[i], module, functions[i]);
+    }
+    // one buffer, one write
+    size_t size = prologue.size() + pool.size();
+    for (const std::string &text : functions) {
+        size += text.size();
+    }
+    std::string program;
+    program.reserve(size);
+    program += prologue;
+    program += pool;
+    for (const std::string &text : functions) {
+        program += text;
+    }
+    object_code.write(program.data(), program.size());
+    object_code.flush();
+}
+
+std::string CBackend::function_head(const ir::Function &function) {
+    if (function.kind == ir::FunctionKind::Main) {
+        return "int main(int argc, char **argv)";
+    }
+    std::string params;
+    for (const ir::Var &var : function.vars) {
+        if (var.param) {
+            params += std::string(params.empty() ? "" : ", ") + "obj_Obj " + var.name;
+        }
+    }
+    return "obj_Obj " + function.name + "(" + (params.empty() ? std::string("void") : params) + ")";
+}
+
+void CBackend::gen_declarations(TypeId clazz, const ir::Module &module) {
+    const ClassLayout &layout = ss->layouts[clazz];
+    std::string cname = layout.name.str();
+    // instance variables in layout order, so a subclass object also works as its superclass
+    emit("typedef struct obj_" + cname + "_struct {");
+    emit("class_Obj clazz;");
+    for (Symbol field : layout.fields) {
+        emit("obj_Obj f_" + field.str() + ";");
+    }
+    emit("} * obj_" + cname + ";");
+    for (const ir::Function &function : module.functions) {
+        if (function.kind != ir::FunctionKind::Main && function.clazz == clazz) {
+            emit("obj_Obj " + function.name
+                 + param_types(function.arity(), function.kind == ir::FunctionKind::Method) + ";");
+        }
+    }
+}
+
+/* The method table is a constant array laid out by the compiler;
+ * slot k holds the same method in this class and all its subclasses.
+ */
+void CBackend::gen_vtable(TypeId clazz) {
+    const ClassLayout &layout = ss->layouts[clazz];
+    emit("const vmethod the_class_" + layout.name.str() + "_vtable[] = {");
+    for (size_t slot = 0; slot < layout.slots.size(); slot++) {
+        const VtableSlot &entry = layout.slots[slot];
+        emit("    (vmethod) " + entry.impl + ",  /* " + std::to_string(slot) + " " + entry.method.str() + " */");
+    }
+    emit("};");
+}
+
+/* What the collector needs to know about objects of this class:
+ * their size and where the fields are.  Every field refers to an object.
+ */
+void CBackend::gen_type_descriptor(TypeId clazz) {
+    const ClassLayout &layout = ss->layouts[clazz];
+    std::string cname = layout.name.str();
+    std::string offsets = "NULL";
+    if (!layout.fields.empty()) {
+        offsets = "the_type_" + cname + "_offsets";
+        emit("const size_t " + offsets + "[] = {");
+        for (Symbol field : layout.fields) {
+            emit("    offsetof(struct obj_" + cname + "_struct, f_" + field.str() + "),");
+        }
+        emit("};");
+    }
+    emit("const quack_type the_type_" + cname + " = { (class_Obj) the_class_" + cname + "_vtable, \""
+         + cname + "\", sizeof(struct obj_" + cname + "_struct), 0, "
+         + std::to_string(layout.fields.size()) + ", " + offsets + ", NULL };");
+}
+
+/* Literals are static objects in the data segment, with a header
+ * that keeps the collector away from them.
+ */
+void CBackend::gen_literals(const ir::Module &module) {
+    for (const std::pair<const long, std::string> &literal : module.int_literals) {
+        emit("static quack_static_Int " + literal.second + " = { QUACK_STATIC_HEADER, { &the_class_Int_struct, "
+             + std::to_string(literal.first) + " } };");
+    }
+    for (const std::pair<const std::string, std::string> &literal : module.str_literals) {
+        const std::string &text = literal.first;
+        emit("static quack_static_String " + literal.second + " = { QUACK_STATIC_HEADER, { &the_class_String_struct, NULL, NULL, \""
+             + text + "\", sizeof(\"" + text + "\") - 1, 0, 0 } };");
+    }
+}
+
+/* Declarations first, then a shadow stack frame holding the address
+ * of every object variable, so the collector can find and update
+ * them, then the blocks.  Every return pops the frame.
+ */
+void CBackend::gen_function(const ir::Function &function, const ir::Module &module, std::string &text) {
+    std::string body;
+    section = &text;
+    emit(function_head(function) + " {");
+    std::vector<std::string> roots;
+    for (const ir::Var &var : function.vars) {
+        if (var.rep == ir::Rep::Object) {
+            roots.push_back("&" + var.name);
+        }
+        if (var.param) {
+            continue;
+        }
+        std::string comment = var.comment.empty() ? "" : " // " + var.comment;
+        if (var.rep == ir::Rep::Object) {
+            emit("obj_Obj " + var.name + " = NULL;" + comment);
+        } else {
+            emit("int " + var.name + ";" + comment);
+        }
+    }
+    if (roots.empty()) {
+        emit("quack_frame gc_frame = { quack_frames, 0, NULL };");
+    } else {
+        emit("obj_Obj *gc_roots[] = { " + join(roots) + " };");
+        emit("quack_frame gc_frame = { quack_frames, " + std::to_string(roots.size()) + ", gc_roots };");
+    }
+    emit("quack_frames = &gc_frame;");
+    section = &body;
+    if (function.kind == ir::FunctionKind::Main) {
+        // the collector finds the fields of user objects through these
+        for (TypeId clazz : module.classes) {
+            emit("quack_register_type(&the_type_" + ss->layouts[clazz].name.str() + ");");
+        }
+    }
+    // a jump to the next block just falls through
+    auto falls = [&function](size_t b, const ir::Instr &instr) {
+        return instr.op == ir::Op::Jump && b + 1 < function.blocks.size()
+               && function.blocks[b + 1].label == instr.target;
+    };
+    // only the labels some goto names, or gcc warns about the others
+    std::set<std::string> targets;
+    for (size_t b = 0; b < function.blocks.size(); b++) {
+        for (const ir::Instr &instr : function.blocks[b].code) {
+            if (instr.is_terminator() && !falls(b, instr)) {
+                targets.insert(instr.target);
+                targets.insert(instr.other);
+            }
+        }
+    }
+    for (size_t b = 0; b < function.blocks.size(); b++) {
+        const ir::Block &block = function.blocks[b];
+        if (targets.count(block.label) != 0) {
+            emit(block.label + ": ;");
+        }
+        for (const ir::Instr &instr : block.code) {
+            if (!falls(b, instr)) {
+                gen_instr(instr, function);
+            }
+        }
+    }
+    emit("}");
+    text += body;
+}
+
+void CBackend::gen_instr(const ir::Instr &instr, const ir::Function &function) {
+    switch (instr.op) {
+        case ir::Op::Move:
+            emit(instr.dst + " = " + instr.a + ";");
+            break;
+        case ir::Op::IntConst:
+            emit(instr.dst + " = " + std::to_string(instr.value) + ";");
+            break;
+        case ir::Op::Literal:
+            emit(instr.dst + " = (obj_Obj) " + instr.name + ";");
+            break;
+        case ir::Op::Box:
+            if (instr.type == types::Boolean) {
+                emit(instr.dst + " = " + instr.a + " ? (obj_Obj) lit_true : (obj_Obj) lit_false;");
+            } else {
+                emit(instr.dst + " = (obj_Obj) int_literal(" + instr.a + ");");
+            }
+            break;
+        case ir::Op::Unbox:
+            if (instr.type == types::Boolean) {
+                emit(instr.dst + " = " + instr.a + " == (obj_Obj) lit_true;");
+            } else {
+                emit(instr.dst + " = ((obj_Int) " + instr.a + ")->value;");
+            }
+            break;
+        case ir::Op::Arith:
+            if (instr.wraps) {
+                emit(instr.dst + " = (int) ((unsigned) " + instr.a + " " + instr.name + " (unsigned) " + instr.b + ");");
+            } else {
+                emit(instr.dst + " = " + instr.a + " " + instr.name + " " + instr.b + ";");
+            }
+            break;
+        case ir::Op::Not:
+            emit(instr.dst + " = !" + instr.a + ";");
+            break;
+        case ir::Op::GetField:
+            emit(instr.dst + " = ((obj_" + ss->layouts[instr.type].name.str() + ") " + instr.a + ")->f_" + instr.name + ";");
+            break;
+        case ir::Op::SetField:
+            emit("((obj_" + ss->layouts[instr.type].name.str() + ") " + instr.a + ")->f_" + instr.name + " = " + instr.b + ";");
+            break;
+        case ir::Op::Call:
+            if (instr.type == types::Unset) {
+                emit(instr.dst + " = (obj_Obj) " + instr.name + "(" + join(instr.args) + ");");
+            } else {
+                emit(instr.dst + " = " + direct_call(instr.name, instr.args) + ";");
+            }
+            break;
+        case ir::Op::Send:
+            gen_send(instr);
+            break;
+        case ir::Op::Alloc: {
+            std::string cname = ss->layouts[instr.type].name.str();
+            emit(instr.dst + " = quack_alloc(sizeof(struct obj_" + cname + "_struct), (class_Obj) the_class_" + cname + "_vtable);");
+            break;
+        }
+        case ir::Op::Jump:
+            emit("goto " + instr.target + ";");
+            break;
+        case ir::Op::Branch:
+            emit("if (" + instr.a + (instr.name.empty() ? "" : " " + instr.name + " " + instr.b) + ") goto "
+                 + instr.target + "; else goto " + instr.other + ";");
+            break;
+        case ir::Op::BranchClass: {
+            std::string test;
+            for (TypeId clazz : instr.classes) {
+                test += std::string(test.empty() ? "" : " || ") + "VTABLE(" + instr.a + ") == " + vtable_of(ss, clazz);
+            }
+            emit("if (" + (test.empty() ? std::string("0") : test) + ") goto " + instr.target + "; else goto " + instr.other + ";");
+            break;
+        }
+        case ir::Op::Return:
+            emit("quack_frames = gc_frame.prev;");
+            if (function.kind == ir::FunctionKind::Main) {
+                emit("return 0;");
+            } else if (instr.a.empty()) {
+                emit("return (obj_Obj) nothing;");
+            } else {
+                emit("return " + instr.a + ";");
+            }
+            break;
+        case ir::Op::Comment:
+            emit("// " + instr.name);
+            break;
+    }
+}
+
+/* A call through the method table, unless the classes the receiver can
+ * be are few enough to test for.
+ */
+void CBackend::gen_send(const ir::Instr &instr) {
+    const std::string &target_reg = instr.dst;
+    const std::string &receiver = instr.args[0];
+    size_t arity = instr.args.size() - 1;
+    std::string args = join(instr.args);
+    int slot = (int) instr.value;
+    std::string comment = " // " + (instr.type == types::Unset ? std::string("?") : ss->layouts[instr.type].name.str())
+                          + "." + instr.name;
+    std::string call_type = "(" + method_type(arity) + ")";
+    std::string lookup = "VTABLE(" + receiver + ")[" + std::to_string(slot) + "]";
+    const std::vector<TypeId> &receivers = instr.classes;
+    if (receivers.size() > 1 && receivers.size() <= MAX_TESTED_CLASSES) {
+        /* Few classes can get here: test for each of them and call its
+         * method directly, which the C compiler can inline.  Classes
+         * sharing an implementation share a test.
+         */
+        std::vector<std::string> impls;
+        std::map<std::string, std::string> tests;
+        for (TypeId clazz : receivers) {
+            const std::string &impl = ss->layouts[clazz].slots[slot].impl;
+            if (tests.count(impl) == 0) {
+                impls.push_back(impl);
+            }
+            std::string &test = tests[impl];
+            test += std::string(test.empty() ? "" : " || ") + "VTABLE(" + receiver + ") == " + vtable_of(ss, clazz);
+        }
+        std::string keyword = "if";
+        for (const std::string &impl : impls) {
+            emit(keyword + " (" + tests[impl] + ") " + target_reg + " = "
+                 + direct_call(impl, instr.args) + ";");
+            keyword = "else if";
+        }
+        emit("else " + target_reg + " = (" + call_type + " " + lookup + ")(" + args + ");" + comment);
+    } else {
+        emit(target_reg + " = (" + call_type + " " + lookup + ")(" + args + ");" + comment);
+    }
+}
@@ -0,0 +1,51 @@
+//
+// The C backend: prints the IR of a whole program (IR.h) as one C
+// translation unit, which #includes the runtime (Builtins.c).
+//
+// Everything about C lives here: object structs and method tables
+// from the class layouts, the collector's type descriptors and
+// shadow stack frames, and how a method call is dispatched.
+//
+// Output is built in memory, in sections: the declarations of the
+// classes, the literal pool, and one section per function (itself
+// put together from its declarations and its body).  The whole
+// program then goes out in a single write.
+//
+
+#ifndef CBACKEND_H
+#define CBACKEND_H
+
+#include <ostream>
+#include <string>
+#include "IR.h"
+
+class StaticSemantics;
+struct ClassLayout;
+
+class CBackend {
+    std::ostream &object_code;
+    StaticSemantics *ss;
+    std::string *section = nullptr;   // where emit puts code
+
+    void emit(const std::string &s) { section->append(" ").append(s).append("\n"); }
+
+    std::string function_head(const ir::Function &function);
+    // Object struct and prototypes
+    void gen_declarations(TypeId clazz, const ir::Module &module);
+    // The method table, a static array
+    void gen_vtable(TypeId clazz);
+    // Size and fields of its objects, for the collector
+    void gen_type_descriptor(TypeId clazz);
+    void gen_literals(const ir::Module &module);
+    // The whole function, in 'text'
+    void gen_function(const ir::Function &function, const ir::Module &module, std::string &text);
+    void gen_instr(const ir::Instr &instr, const ir::Function &function);
+    void gen_send(const ir::Instr &instr);
+
+public:
+    CBackend(std::ostream &out, StaticSemantics *ss) : object_code{out}, ss{ss} {}
+
+    void gen_module(const ir::Module &module);
+};
+
+#endif //CBACKEND_H
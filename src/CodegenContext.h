@@ -3,63 +3,227 @@
 // while walking the AST to generate code.  A context is passed along from
 // from node to node as the tree is walked.
 //
-// For this small calculator example (with the rather impractical
-// approach of evaluating some simple expressions by translating
-// them to C code and then compiling and running the C code) we
-// need an output stream and a table of variable values.
+// Walking the AST builds the intermediate representation (IR.h): the
+// context knows which function and which basic block we are adding
+// to, and the variables of the function.  The C backend (CBackend.h)
+// prints the result.
 //
 
 #ifndef AST_CODEGENCONTEXT_H
 #define AST_CODEGENCONTEXT_H
 
+#include <algorithm>
+#include <cassert>
 #include <ostream>
 #include <map>
+#include <vector>
+#include "Symbols.h"
+#include "Types.h"
+#include "IR.h"
 
 using namespace std;
 
+class StaticSemantics;
+
 class CodegenContext {
-    // In place of registers, we'll use local integer variables.
-    // Declarations are tricky if we reuse variable names, so we'll
-    // just create as many temporaries as we need.
+    // In place of registers, we'll use local variables, numbered
+    // from 0 in each function.  A temporary that is given back with
+    // free_reg holds the next value of the same kind that needs one.
     int next_reg_num = 0;
+    std::vector<std::string> free_object_regs;
+    std::vector<std::string> free_int_regs;
     int next_label_num = 0;
-    std::map<std::string, std::string> local_vars;
-    std::ostream &object_code;
+    std::map<Symbol, std::string> local_vars;
+    // Int or Boolean for the local variables we keep as a plain C int
+    std::map<Symbol, TypeId> unboxed_vars;
+    // static types of the variables of the current function, from type inference
+    const std::map<Symbol, TypeId> *var_types = nullptr;
+    ir::Module &module;
+    ir::Function *function = nullptr;   // the function we are building
+
+    /* The block instructions go to.  After a jump or a return, code
+     * that has no label of its own can never run; it still gets a
+     * block, so that every block ends in exactly one terminator.
+     */
+    ir::Block &current() {
+        if (function->blocks.back().terminated()) {
+            function->blocks.push_back(ir::Block{new_branch_label("dead"), {}});
+        }
+        return function->blocks.back();
+    }
+
 public:
-    explicit CodegenContext(std::ostream &out) : object_code{out} {};
-    void emit(std::string s) { object_code << " " << s  << std::endl; }
+    // Class layouts (method slots, fields) worked out by the static semantics
+    StaticSemantics *ss;
+    // Class whose constructor or method we are in (types::Unset in main)
+    TypeId this_class = types::Unset;
+
+    explicit CodegenContext(ir::Module &module, StaticSemantics *ss = nullptr) : module{module}, ss{ss} {};
+
+    void append(ir::Instr instr) { current().code.push_back(instr); }
+
+    // A user class, whose struct, method table and type descriptor the program needs
+    void add_class(TypeId clazz) { module.classes.push_back(clazz); }
+
+    /* A local variable of the current function.
+     * An object variable starts out NULL and is a root for the collector.
+     */
+    void declare(std::string name, bool object, std::string comment = "") {
+        function->add_var(ir::Var{name, object ? ir::Rep::Object : ir::Rep::Int, false, comment});
+    }
 
     /* Getting the name of a "register" (really a local variable in C)
-     * has the side effect of emitting a declaration for the variable.
+     * has the side effect of declaring the variable, unless a free
+     * one of the same kind can be used again.
      */
-    std::string alloc_reg() {
-        int reg_num = next_reg_num++;
-        std::string reg_name = "tmp__" + std::to_string(reg_num);
-        object_code <<" obj_Obj " << reg_name << ";" << std::endl;
+    std::string alloc_temp(bool object) {
+        std::vector<std::string> &free_regs = object ? free_object_regs : free_int_regs;
+        function->temp_values++;
+        if (!free_regs.empty()) {
+            std::string reg_name = free_regs.back();
+            free_regs.pop_back();
+            return reg_name;
+        }
+        std::string reg_name = "tmp__" + std::to_string(next_reg_num++);
+        declare(reg_name, object);
+        function->temps++;
         return reg_name;
     }
 
+    std::string alloc_reg() { return alloc_temp(true); }
+
+    /* A "register" holding a raw C int: the value of an Int, or
+     * 0 / 1 for a Boolean.
+     */
+    std::string alloc_int_reg() { return alloc_temp(false); }
+
+    /* The code that asked for a register is done with it: nothing
+     * after this point reads its value.  Anything that is not a
+     * temporary (a source variable, a parameter) is left alone.
+     */
     void free_reg(std::string reg) {
-        // We don't have real registers, so there is nothing to free.
-        this->emit(std::string("// Free ") + reg);
+        const ir::Var *var = function->var(reg);
+        if (var == nullptr || var->param || reg.compare(0, 5, "tmp__") != 0) {
+            return;
+        }
+        std::vector<std::string> &free_regs = var->rep == ir::Rep::Object ? free_object_regs : free_int_regs;
+        assert(std::find(free_regs.begin(), free_regs.end(), reg) == free_regs.end());
+        free_regs.push_back(reg);
     }
 
-    /* Get internal name for a calculator variable.
-     * Possible side effect of generating a declaration if
-     * the variable has not been mentioned before.  (Later,
-     * we should buffer up the program to avoid this.)
+    void free_regs(const std::vector<std::string> &regs) {
+        for (const std::string &reg : regs) {
+            free_reg(reg);
+        }
+    }
+
+    // How many temporaries the functions needed, for the -s statistics
+    void report_temps(std::ostream &out) {
+        int temps = 0;
+        int values = 0;
+        const ir::Function *largest = nullptr;
+        for (const ir::Function &f : module.functions) {
+            temps += f.temps;
+            values += f.temp_values;
+            if (largest == nullptr || f.temps > largest->temps) {
+                largest = &f;
+            }
+        }
+        out << "Codegen temporaries: " << temps << " for " << values << " values";
+        if (largest != nullptr) {
+            out << ", at most " << largest->temps << " (in " << largest->name << ")";
+        }
+        out << std::endl;
+    }
+
+    /* Get internal name for a source variable.
+     * Possible side effect of declaring it, if
+     * the variable has not been mentioned before.
      */
-    std::string get_local_var(std::string &ident) {
+    std::string get_local_var(Symbol ident) {
         if (local_vars.count(ident) == 0) {
-            std::string internal = std::string("calc_var_") + ident;
+            std::string internal = std::string("var_") + ident.str();
             local_vars[ident] = internal;
-            // We'll need a declaration in the generated code
-            this->emit(std::string("int ") + internal + "; // Source variable " + ident);
+            // A variable that is exactly an Int or a Boolean everywhere needs no object
+            TypeId type = types::Unset;
+            if (var_types != nullptr && var_types->count(ident) != 0) {
+                type = var_types->at(ident);
+            }
+            bool unboxed = type == types::Int || type == types::Boolean;
+            if (unboxed) {
+                unboxed_vars[ident] = type;
+            }
+            declare(internal, !unboxed, "Source variable " + ident.str());
             return internal;
         }
         return local_vars[ident];
     }
 
+    /* Each C function has its own local variables.  Parameters are
+     * bound up front, since they are declared in the function head.
+     */
+    void begin_function(std::string name, ir::FunctionKind kind, TypeId clazz, const std::map<Symbol, TypeId> *vars) {
+        local_vars.clear();
+        unboxed_vars.clear();
+        next_reg_num = 0;
+        free_object_regs.clear();
+        free_int_regs.clear();
+        this_class = clazz;
+        var_types = vars;
+        module.functions.push_back(ir::Function(name, kind, clazz));
+        function = &module.functions.back();
+        function->blocks.push_back(ir::Block{"entry", {}});
+    }
+
+    // Parameters are always objects
+    void add_param(std::string internal) {
+        function->add_var(ir::Var{internal, ir::Rep::Object, true, ""});
+    }
+
+    void bind_local(Symbol ident, std::string internal) {
+        local_vars[ident] = internal;
+        add_param(internal);
+    }
+
+    // Falling off the end returns nothing (or 0, from main)
+    void end_function() {
+        if (!function->blocks.back().terminated()) {
+            ret();
+        }
+        function = nullptr;
+    }
+
+    /* Int or Boolean if the variable is kept as a C int, else types::Unset.
+     * Declares the variable if this is its first mention.
+     */
+    TypeId unboxed_type(Symbol ident) {
+        get_local_var(ident);
+        auto found = unboxed_vars.find(ident);
+        return found == unboxed_vars.end() ? types::Unset : found->second;
+    }
+
+    /* Literals are static objects, one per distinct value in the whole
+     * program.  These give the object for one, to load with literal().
+     */
+    std::string int_literal(long value) {
+        auto found = module.int_literals.find(value);
+        if (found == module.int_literals.end()) {
+            std::string name = "lit_int_" + std::string(value < 0 ? "m" : "") + std::to_string(value < 0 ? -value : value);
+            found = module.int_literals.insert(std::make_pair(value, name)).first;
+        }
+        return "&" + found->second + ".obj";
+    }
+
+    // 'text' is already a valid C string literal body
+    std::string str_literal(std::string text) {
+        auto found = module.str_literals.find(text);
+        if (found == module.str_literals.end()) {
+            std::string name = "lit_str_" + std::to_string(module.str_literals.size());
+            found = module.str_literals.insert(std::make_pair(text, name)).first;
+        }
+        return "&" + found->second + ".obj";
+    }
+
     /* Get a new, unique branch label.  We use a prefix
      * string just to make the object code a little more
      * readable by indicating what the label was for
@@ -70,6 +234,164 @@ public:
         return std::string(prefix) + "_" + std::to_string(++next_label_num);
     }
 
+    // Start the block 'label'; the block before falls through to it
+    void place_label(std::string label) {
+        if (!function->blocks.back().terminated()) {
+            jump(label);
+        }
+        function->blocks.push_back(ir::Block{label, {}});
+    }
+
+    /* Instructions, added to the current block (see IR.h) */
+
+    void move(std::string dst, std::string src) {
+        ir::Instr instr(ir::Op::Move);
+        instr.dst = dst;
+        instr.a = src;
+        append(instr);
+    }
+
+    void int_const(std::string dst, long value) {
+        ir::Instr instr(ir::Op::IntConst);
+        instr.dst = dst;
+        instr.value = value;
+        append(instr);
+    }
+
+    void literal(std::string dst, std::string object) {
+        ir::Instr instr(ir::Op::Literal);
+        instr.dst = dst;
+        instr.name = object;
+        append(instr);
+    }
+
+    void box(std::string dst, std::string value, TypeId type) {
+        ir::Instr instr(ir::Op::Box);
+        instr.dst = dst;
+        instr.a = value;
+        instr.type = type;
+        append(instr);
+    }
+
+    void unbox(std::string dst, std::string object, TypeId type) {
+        ir::Instr instr(ir::Op::Unbox);
+        instr.dst = dst;
+        instr.a = object;
+        instr.type = type;
+        append(instr);
+    }
+
+    void arith(std::string dst, std::string op, std::string left, std::string right) {
+        ir::Instr instr(ir::Op::Arith);
+        instr.dst = dst;
+        instr.name = op;
+        instr.a = left;
+        instr.b = right;
+        append(instr);
+    }
+
+    void logical_not(std::string dst, std::string value) {
+        ir::Instr instr(ir::Op::Not);
+        instr.dst = dst;
+        instr.a = value;
+        append(instr);
+    }
+
+    void get_field(std::string dst, std::string object, TypeId clazz, Symbol field) {
+        ir::Instr instr(ir::Op::GetField);
+        instr.dst = dst;
+        instr.a = object;
+        instr.type = clazz;
+        instr.name = field.str();
+        append(instr);
+    }
+
+    void set_field(std::string object, TypeId clazz, Symbol field, std::string value) {
+        ir::Instr instr(ir::Op::SetField);
+        instr.a = object;
+        instr.b = value;
+        instr.type = clazz;
+        instr.name = field.str();
+        append(instr);
+    }
+
+    // 'clazz' is the class of the method called, if it is one
+    void call(std::string dst, std::string function_name, std::vector<std::string> args, TypeId clazz = types::Unset) {
+        ir::Instr instr(ir::Op::Call);
+        instr.dst = dst;
+        instr.name = function_name;
+        instr.args = args;
+        instr.type = clazz;
+        append(instr);
+    }
+
+    // args[0] is the receiver
+    void send(std::string dst, Symbol method, int slot, TypeId receiver_type,
+              std::vector<TypeId> receivers, std::vector<std::string> args) {
+        ir::Instr instr(ir::Op::Send);
+        instr.dst = dst;
+        instr.name = method.str();
+        instr.value = slot;
+        instr.type = receiver_type;
+        instr.classes = receivers;
+        instr.args = args;
+        append(instr);
+    }
+
+    void alloc(std::string dst, TypeId clazz) {
+        ir::Instr instr(ir::Op::Alloc);
+        instr.dst = dst;
+        instr.type = clazz;
+        append(instr);
+    }
+
+    void jump(std::string label) {
+        ir::Instr instr(ir::Op::Jump);
+        instr.target = label;
+        append(instr);
+    }
+
+    void branch(std::string cond, std::string true_branch, std::string false_branch) {
+        ir::Instr instr(ir::Op::Branch);
+        instr.a = cond;
+        instr.target = true_branch;
+        instr.other = false_branch;
+        append(instr);
+    }
+
+    // Branch on 'left op right', C ints, without keeping the result
+    void compare_branch(std::string op, std::string left, std::string right,
+                        std::string true_branch, std::string false_branch) {
+        ir::Instr instr(ir::Op::Branch);
+        instr.name = op;
+        instr.a = left;
+        instr.b = right;
+        instr.target = true_branch;
+        instr.other = false_branch;
+        append(instr);
+    }
+
+    void branch_class(std::string object, std::vector<TypeId> classes, std::string match, std::string no_match) {
+        ir::Instr instr(ir::Op::BranchClass);
+        instr.a = object;
+        instr.classes = classes;
+        instr.target = match;
+        instr.other = no_match;
+        append(instr);
+    }
+
+    void ret(std::string value = "") {
+        ir::Instr instr(ir::Op::Return);
+        instr.a = value;
+        append(instr);
+    }
+
+    void comment(std::string text) {
+        ir::Instr instr(ir::Op::Comment);
+        instr.name = text;
+        append(instr);
+    }
+
 };
 
 
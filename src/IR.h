@@ -0,0 +1,164 @@
+//
+// The intermediate representation between the type-checked AST and C.
+//
+// Code generation turns each constructor, method, and the main program
+// into an ir::Function: basic blocks of three-address instructions over
+// named variables (temporaries, source variables, parameters), each of
+// which holds either an object or a plain C int.  A block ends with a
+// jump, a branch, or a return, and every block is reachable only by
+// name, so passes can rewrite code here without knowing any C.  The C
+// backend (CBackend.h) prints a whole Module.
+//
+
+#ifndef IR_H
+#define IR_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "Types.h"
+
+namespace ir {
+
+    // What a variable holds
+    enum class Rep {
+        Object,   // an obj_Obj
+        Int       // a C int: the value of an Int, or 0 / 1 for a Boolean
+    };
+
+    struct Var {
+        std::string name;
+        Rep rep;
+        bool param;            // declared in the function head
+        std::string comment;   // e.g., the source variable it stands for
+    };
+
+    enum class Op {
+        Move,         // dst = a
+        IntConst,     // dst = value                           (Int)
+        Literal,      // dst = the static object 'name'        (lit_true, &lit_int_3.obj, ...)
+        Box,          // dst = an object of 'type' (Int or Boolean) for the C int a
+        Unbox,        // dst = the C int in a, an object of 'type'
+        Arith,        // dst = a 'name' b, C ints; 'name' is + - * / < > <= >= ==;
+                      //   + - * wrap around, as unsigned, if 'wraps' is set
+        Not,          // dst = !a                              (Int)
+        GetField,     // dst = a.name, a of class 'type'
+        SetField,     // a.name = b, a of class 'type'
+        Call,         // dst = name(args), a known function; 'type' is its class if it is a method
+        Send,         // dst = args[0].name(args[1..]) through slot 'value';
+                      //   'type' is the receiver's static class, 'classes' what it can be
+        Alloc,        // dst = a new object of class 'type', fields not yet set
+        Jump,         // goto target
+        Branch,       // if (a) goto target, else goto other; if (a 'name' b), C ints, if 'name' is set
+        BranchClass,  // if the class of a is one of 'classes' goto target, else goto other
+        Return,       // return a (nothing from a method, 0 from main, if a is empty)
+        Comment       // name
+    };
+
+    struct Instr {
+        Op op;
+        std::string dst;
+        std::string a;
+        std::string b;
+        std::vector<std::string> args;
+        std::string name;
+        long value = 0;
+        bool wraps = false;
+        TypeId type = types::Unset;
+        std::vector<TypeId> classes;
+        std::string target;
+        std::string other;
+
+        explicit Instr(Op op) : op{op} {}
+
+        bool is_terminator() const {
+            return op == Op::Jump || op == Op::Branch || op == Op::BranchClass || op == Op::Return;
+        }
+
+        // the variables this instruction reads
+        std::vector<std::string> uses() const {
+            std::vector<std::string> used;
+            if (!a.empty()) used.push_back(a);
+            if (!b.empty()) used.push_back(b);
+            used.insert(used.end(), args.begin(), args.end());
+            return used;
+        }
+    };
+
+    struct Block {
+        std::string label;
+        std::vector<Instr> code;
+
+        bool terminated() const { return !code.empty() && code.back().is_terminator(); }
+    };
+
+    enum class FunctionKind { Constructor, Method, Main };
+
+    struct Function {
+        std::string name;      // the C name: new_C, C_method_m, main
+        FunctionKind kind;
+        TypeId clazz;          // the class of a constructor or method
+        std::vector<Var> vars;    // parameters first, in order
+        std::map<std::string, size_t> var_index;
+        std::vector<Block> blocks;    // blocks[0] is the entry
+        int temps = 0;             // temporaries declared
+        int temp_values = 0;       // values put in temporaries, which may share one
+
+        Function(std::string name, FunctionKind kind, TypeId clazz) :
+                name{name}, kind{kind}, clazz{clazz} {}
+
+        void add_var(Var v) {
+            var_index[v.name] = vars.size();
+            vars.push_back(v);
+        }
+
+        // the variable called 'name', or nullptr
+        const Var *var(const std::string &name) const {
+            auto found = var_index.find(name);
+            return found == var_index.end() ? nullptr : &vars[found->second];
+        }
+
+        // the variables some instruction still mentions, and the parameters
+        void drop_unused_vars() {
+            std::set<std::string> used;
+            for (const Block &block : blocks) {
+                for (const Instr &instr : block.code) {
+                    used.insert(instr.dst);
+                    std::vector<std::string> read = instr.uses();
+                    used.insert(read.begin(), read.end());
+                }
+            }
+            std::vector<Var> kept;
+            for (const Var &v : vars) {
+                if (v.param || used.count(v.name) != 0) {
+                    kept.push_back(v);
+                }
+            }
+            vars.clear();
+            var_index.clear();
+            for (const Var &v : kept) {
+                add_var(v);
+            }
+        }
+
+        size_t arity() const {
+            size_t params = 0;
+            for (const Var &v : vars) {
+                if (v.param) params++;
+            }
+            return this->kind == FunctionKind::Method ? params - 1 : params;
+        }
+    };
+
+    struct Module {
+        std::vector<TypeId> classes;   // user classes, in source order
+        std::vector<Function> functions;
+        // Literal objects, one per distinct value: value -> name
+        std::map<long, std::string> int_literals;
+        std::map<std::string, std::string> str_literals;   // keyed by C source text
+    };
+
+}
+
+#endif //IR_H
@@ -0,0 +1,984 @@
+//
+// Optimization passes over the IR (see Optimize.h)
+//
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <set>
+#include "Optimize.h"
+#include "staticsemantics.cpp"
+
+namespace opt {
+
+    void Stats::report(std::ostream &out) {
+        out << "Method calls: " << sends << ", " << direct << " direct" << std::endl;
+        out << "Calls inlined: " << inlined << std::endl;
+        out << "Allocations: " << allocs << ", " << replaced << " replaced by variables" << std::endl;
+        out << "Loops: " << hoisted << " computations hoisted, " << reduced << " multiplications reduced" << std::endl;
+    }
+
+    // The blocks that can come after 'block'
+    static std::vector<std::string> successors(const ir::Block &block) {
+        std::vector<std::string> next;
+        if (block.terminated()) {
+            const ir::Instr &last = block.code.back();
+            if (!last.target.empty()) next.push_back(last.target);
+            if (!last.other.empty()) next.push_back(last.other);
+        }
+        return next;
+    }
+
+    // The classes the object in a variable can be, for the variables where we know for sure
+    typedef std::map<std::string, std::vector<TypeId>> Known;
+
+    // What we know after 'instr'; a call that made a method call plain
+    // (a Call with a type) says nothing about its result
+    static void track_classes(const ir::Instr &instr, const std::map<std::string, TypeId> &constructors, Known &known) {
+        if (instr.dst.empty()) {
+            return;
+        }
+        auto made = constructors.find(instr.name);
+        if (instr.op == ir::Op::Move && known.count(instr.a) != 0) {
+            known[instr.dst] = known[instr.a];
+        } else if (instr.op == ir::Op::Alloc) {
+            known[instr.dst] = {instr.type};
+        } else if (instr.op == ir::Op::Call && instr.type == types::Unset && made != constructors.end()) {
+            known[instr.dst] = {made->second};
+        } else {
+            known.erase(instr.dst);
+        }
+    }
+
+    /* Where paths meet, a variable is known if it is on each of them,
+     * to be one of the classes it can be on any.  'set' is false until
+     * the first path gets there.  True if that changed 'into'.
+     */
+    static bool join_known(Known &into, bool set, const Known &from) {
+        if (!set) {
+            into = from;
+            return true;
+        }
+        bool changed = false;
+        for (auto it = into.begin(); it != into.end();) {
+            auto other = from.find(it->first);
+            if (other == from.end()) {
+                it = into.erase(it);
+                changed = true;
+                continue;
+            }
+            std::vector<TypeId> both;
+            std::set_union(it->second.begin(), it->second.end(), other->second.begin(), other->second.end(),
+                           std::back_inserter(both));
+            changed = changed || both != it->second;
+            it->second = both;
+            ++it;
+        }
+        return changed;
+    }
+
+    /* A receiver is an object of its static type or a subclass; the
+     * call site lists those classes.  Some receivers we know better:
+     * 'this' is an object of the function's class, or of a subclass in
+     * an inherited method, and an object made by a constructor is of
+     * exactly its class, in every block it reaches unchanged (so a loop
+     * can call methods of an object made before it).  The slot number
+     * comes from the static type too, so a receiver of any other class
+     * could not be called through the method table either: if every
+     * class it can be has the same method in the slot, a plain call is
+     * as safe.
+     */
+    void devirtualize(ir::Module &module, StaticSemantics *ss, Stats &stats) {
+        std::map<std::string, TypeId> constructors;
+        for (const ir::Function &function : module.functions) {
+            if (function.kind == ir::FunctionKind::Constructor) {
+                constructors[function.name] = function.clazz;
+            }
+        }
+        for (ir::Function &function : module.functions) {
+            Known entry;
+            if (function.kind == ir::FunctionKind::Constructor) {
+                entry["this"] = {function.clazz};    // never assigned
+            } else if (function.kind == ir::FunctionKind::Method) {
+                entry["this"] = ss->subclasses(function.clazz);
+            }
+            // what we know at the start of each block, over the whole function
+            std::map<std::string, const ir::Block *> blocks;
+            for (const ir::Block &block : function.blocks) {
+                blocks[block.label] = &block;
+            }
+            std::map<std::string, Known> at_start;
+            std::set<std::string> reached;
+            at_start[function.blocks.front().label] = entry;
+            reached.insert(function.blocks.front().label);
+            std::vector<const ir::Block *> work{&function.blocks.front()};
+            while (!work.empty()) {
+                const ir::Block *block = work.back();
+                work.pop_back();
+                Known known = at_start[block->label];
+                for (const ir::Instr &instr : block->code) {
+                    track_classes(instr, constructors, known);
+                }
+                for (const std::string &label : successors(*block)) {
+                    if (join_known(at_start[label], reached.count(label) != 0, known) && blocks.count(label) != 0) {
+                        reached.insert(label);
+                        work.push_back(blocks[label]);
+                    }
+                }
+            }
+            for (ir::Block &block : function.blocks) {
+                Known known = at_start[block.label];
+                for (ir::Instr &instr : block.code) {
+                    if (instr.op != ir::Op::Send) {
+                        track_classes(instr, constructors, known);
+                        continue;
+                    }
+                    stats.sends++;
+                    auto found = known.find(instr.args[0]);
+                    std::vector<TypeId> receivers = found != known.end() ? found->second : instr.classes;
+                    std::set<std::string> impls;
+                    for (TypeId clazz : receivers) {
+                        const ClassLayout &layout = ss->layouts[clazz];
+                        if (instr.value >= (long) layout.slots.size()) {
+                            impls.clear();    // not a method of this class: leave it to the method table
+                            break;
+                        }
+                        impls.insert(layout.slots[instr.value].impl);
+                    }
+                    known.erase(instr.dst);
+                    if (impls.size() != 1) {
+                        continue;
+                    }
+                    // type: one of the classes, as for any call of a method
+                    ir::Instr call(ir::Op::Call);
+                    call.dst = instr.dst;
+                    call.name = *impls.begin();
+                    call.args = instr.args;
+                    call.type = receivers[0];
+                    instr = call;
+                    stats.direct++;
+                }
+            }
+        }
+    }
+
+    // Whether some block of 'function' goes to the block 'label'
+    static bool targeted(const ir::Function &function, const std::string &label) {
+        for (const ir::Block &block : function.blocks) {
+            for (const std::string &next : successors(block)) {
+                if (next == label) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // What inlining a function costs: its instructions, not counting comments
+    static int size_of(const ir::Function &function) {
+        int size = 0;
+        for (const ir::Block &block : function.blocks) {
+            for (const ir::Instr &instr : block.code) {
+                if (instr.op != ir::Op::Comment) {
+                    size++;
+                }
+            }
+        }
+        return size;
+    }
+
+    /* Inlining copies the callee's blocks into the caller, with its
+     * variables and labels renamed by a prefix unique to the call site.
+     * The parameters are set from the arguments first, and each return
+     * sets the result and goes on after the call.
+     */
+    class Inliner {
+        const ir::Function &callee;
+        ir::Function &caller;
+        std::string prefix;
+
+        std::string rename(const std::string &name) {
+            return callee.var(name) == nullptr ? name : prefix + name;
+        }
+
+        std::string relabel(const std::string &label) {
+            return label.empty() ? label : prefix + label;
+        }
+
+    public:
+        Inliner(const ir::Function &callee, ir::Function &caller, std::string prefix) :
+                callee{callee}, caller{caller}, prefix{prefix} {}
+
+        /* Blocks for the callee, starting at prefix + "entry", for the call
+         * 'call'.  Only the variables the callee's code mentions come along:
+         * each one is a root the collector scans in the caller.
+         */
+        std::vector<ir::Block> expand(const ir::Instr &call, const std::string &done) {
+            std::set<std::string> used;
+            for (const ir::Block &block : callee.blocks) {
+                for (const ir::Instr &instr : block.code) {
+                    used.insert(instr.dst);
+                    std::vector<std::string> read = instr.uses();
+                    used.insert(read.begin(), read.end());
+                }
+            }
+            for (const ir::Var &var : callee.vars) {
+                if (used.count(var.name) != 0) {
+                    std::string comment = var.comment.empty() ? "" : var.comment + ", ";
+                    caller.add_var(ir::Var{prefix + var.name, var.rep, false, comment + "inlined from " + callee.name});
+                }
+            }
+            std::vector<ir::Block> blocks;
+            for (const ir::Block &block : callee.blocks) {
+                blocks.push_back(ir::Block{relabel(block.label), {}});
+                std::vector<ir::Instr> &code = blocks.back().code;
+                if (&block == &callee.blocks.front()) {
+                    size_t arg = 0;
+                    for (const ir::Var &var : callee.vars) {
+                        if (!var.param) {
+                            continue;
+                        }
+                        const std::string &value = call.args[arg++];
+                        if (used.count(var.name) != 0) {
+                            ir::Instr bind(ir::Op::Move);
+                            bind.dst = prefix + var.name;
+                            bind.a = value;
+                            code.push_back(bind);
+                        }
+                    }
+                }
+                for (ir::Instr instr : block.code) {
+                    if (instr.op == ir::Op::Return) {
+                        ir::Instr result(instr.a.empty() ? ir::Op::Literal : ir::Op::Move);
+                        result.dst = call.dst;
+                        result.a = rename(instr.a);
+                        result.name = instr.a.empty() ? "nothing" : "";
+                        code.push_back(result);
+                        ir::Instr jump(ir::Op::Jump);
+                        jump.target = done;
+                        code.push_back(jump);
+                        continue;
+                    }
+                    instr.dst = rename(instr.dst);
+                    instr.a = rename(instr.a);
+                    instr.b = rename(instr.b);
+                    for (std::string &arg : instr.args) {
+                        arg = rename(arg);
+                    }
+                    if (instr.is_terminator()) {
+                        instr.target = relabel(instr.target);
+                        instr.other = relabel(instr.other);
+                    }
+                    code.push_back(instr);
+                }
+            }
+            return blocks;
+        }
+    };
+
+    void inline_calls(ir::Module &module, int limit, Stats &stats) {
+        if (limit <= 0) {
+            return;
+        }
+        std::map<std::string, size_t> by_name;
+        for (size_t i = 0; i < module.functions.size(); i++) {
+            by_name[module.functions[i].name] = i;
+        }
+        int sites = 0;
+        for (ir::Function &caller : module.functions) {
+            std::vector<ir::Block> blocks;
+            for (const ir::Block &block : caller.blocks) {
+                ir::Block current{block.label, {}};
+                for (const ir::Instr &instr : block.code) {
+                    auto found = instr.op == ir::Op::Call ? by_name.find(instr.name) : by_name.end();
+                    const ir::Function *callee = found == by_name.end() ? nullptr : &module.functions[found->second];
+                    if (callee == nullptr || callee == &caller || callee->kind == ir::FunctionKind::Main
+                        || callee->arity() + (callee->kind == ir::FunctionKind::Method ? 1 : 0) != instr.args.size()
+                        || size_of(*callee) > limit) {
+                        current.code.push_back(instr);
+                        continue;
+                    }
+                    std::string prefix = "inl" + std::to_string(++sites) + "_";
+                    std::string done = prefix + "done";
+                    std::vector<ir::Block> inlined = Inliner(*callee, caller, prefix).expand(instr, done);
+                    if (targeted(*callee, callee->blocks.front().label)) {
+                        ir::Instr jump(ir::Op::Jump);
+                        jump.target = inlined.front().label;
+                        current.code.push_back(jump);
+                    } else {
+                        // nothing comes back to the callee's first block: it goes on from the call
+                        current.code.insert(current.code.end(), inlined.front().code.begin(), inlined.front().code.end());
+                        inlined.erase(inlined.begin());
+                    }
+                    blocks.push_back(current);
+                    blocks.insert(blocks.end(), inlined.begin(), inlined.end());
+                    current = ir::Block{done, {}};
+                    stats.inlined++;
+                }
+                blocks.push_back(current);
+            }
+            caller.blocks = blocks;
+        }
+        for (ir::Function &function : module.functions) {
+            function.drop_unused_vars();
+        }
+    }
+
+    /* For one allocation, what a variable holds at some point: the
+     * object the allocation made last, or an object it made earlier
+     * (stale), or something else.  Unset where we have not been yet;
+     * Maybe where paths disagree.
+     */
+    enum class Holds : char { Unset, Other, Current, Stale, Maybe };
+
+    static Holds join(Holds a, Holds b) {
+        if (a == b || b == Holds::Unset) return a;
+        if (a == Holds::Unset) return b;
+        return Holds::Maybe;
+    }
+
+    /* Where the object made by the allocation 'site' can be, in each
+     * variable, at the start of each block.  A variable that is not
+     * one of the function's (e.g., a literal) holds something else.
+     */
+    class ObjectFlow {
+        const ir::Function &function;
+        const ir::Instr *site;
+
+    public:
+        std::map<std::string, std::vector<Holds>> at_start;
+
+        ObjectFlow(const ir::Function &function, const ir::Instr *site) : function{function}, site{site} {}
+
+        size_t index(const std::string &var) const {
+            auto found = function.var_index.find(var);
+            return found == function.var_index.end() ? function.vars.size() : found->second;
+        }
+
+        // What the variables hold after 'instr'
+        void step(const ir::Instr &instr, std::vector<Holds> &holds) const {
+            if (&instr == site) {
+                for (Holds &h : holds) {
+                    if (h == Holds::Current) h = Holds::Stale;
+                }
+            }
+            size_t dst = index(instr.dst);
+            if (dst == function.vars.size()) {
+                return;
+            }
+            if (&instr == site) {
+                holds[dst] = Holds::Current;
+            } else if (instr.op == ir::Op::Move) {
+                holds[dst] = holds[index(instr.a)];
+            } else {
+                holds[dst] = Holds::Other;
+            }
+        }
+
+        void solve() {
+            std::map<std::string, const ir::Block *> blocks;
+            for (const ir::Block &block : function.blocks) {
+                blocks[block.label] = &block;
+                at_start[block.label] = std::vector<Holds>(function.vars.size() + 1, Holds::Unset);
+            }
+            // variables start out NULL or as arguments: not our object
+            at_start[function.blocks.front().label] = std::vector<Holds>(function.vars.size() + 1, Holds::Other);
+            std::vector<const ir::Block *> work{&function.blocks.front()};
+            while (!work.empty()) {
+                const ir::Block *block = work.back();
+                work.pop_back();
+                std::vector<Holds> holds = at_start[block->label];
+                for (const ir::Instr &instr : block->code) {
+                    step(instr, holds);
+                }
+                for (const std::string &label : successors(*block)) {
+                    std::vector<Holds> &next = at_start[label];
+                    bool changed = false;
+                    for (size_t i = 0; i < holds.size(); i++) {
+                        Holds joined = join(next[i], holds[i]);
+                        changed = changed || joined != next[i];
+                        next[i] = joined;
+                    }
+                    if (changed && blocks.count(label) != 0) {
+                        work.push_back(blocks[label]);
+                    }
+                }
+            }
+        }
+
+        /* The object stays in the function if the only things done with
+         * it are copying it between variables and reading and setting
+         * its fields, and each of those surely has the latest one.
+         */
+        bool escapes() const {
+            for (const ir::Block &block : function.blocks) {
+                std::vector<Holds> holds = at_start.at(block.label);
+                for (const ir::Instr &instr : block.code) {
+                    for (const std::string &used : instr.uses()) {
+                        Holds h = holds[index(used)];
+                        if (h == Holds::Stale || h == Holds::Maybe) {
+                            return true;
+                        }
+                        bool field_use = (instr.op == ir::Op::GetField || instr.op == ir::Op::SetField)
+                                         && used == instr.a && used != instr.b;
+                        if (h == Holds::Current && !field_use && instr.op != ir::Op::Move) {
+                            return true;
+                        }
+                    }
+                    step(instr, holds);
+                }
+            }
+            return false;
+        }
+    };
+
+    // The n-th allocation in the function, or nullptr
+    static const ir::Instr *nth_alloc(const ir::Function &function, size_t n) {
+        for (const ir::Block &block : function.blocks) {
+            for (const ir::Instr &instr : block.code) {
+                if (instr.op == ir::Op::Alloc && n-- == 0) {
+                    return &instr;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /* Replacing an object takes its allocation out of the code, so the
+     * next one to look at is then the n-th again.
+     */
+    void scalar_replace(ir::Module &module, StaticSemantics *ss, Stats &stats) {
+        int objects = 0;
+        for (ir::Function &function : module.functions) {
+            size_t n = 0;
+            while (const ir::Instr *site = nth_alloc(function, n)) {
+                stats.allocs++;
+                ObjectFlow flow(function, site);
+                flow.solve();
+                if (flow.escapes()) {
+                    n++;
+                    continue;
+                }
+                // a variable for each field; the constructor sets them all
+                const ClassLayout &layout = ss->layouts[site->type];
+                std::string prefix = "obj" + std::to_string(++objects) + "_";
+                for (ir::Block &block : function.blocks) {
+                    std::vector<Holds> holds = flow.at_start[block.label];
+                    std::vector<ir::Instr> code;
+                    for (const ir::Instr &instr : block.code) {
+                        Holds object = holds[flow.index(instr.a)];
+                        ir::Instr rewritten = instr;
+                        if (&instr == site) {
+                            rewritten = ir::Instr(ir::Op::Comment);
+                            rewritten.name = "A " + layout.name.str() + " in variables " + prefix + "*";
+                        } else if (object == Holds::Current && instr.op == ir::Op::GetField) {
+                            rewritten = ir::Instr(ir::Op::Move);
+                            rewritten.dst = instr.dst;
+                            rewritten.a = prefix + instr.name;
+                        } else if (object == Holds::Current && instr.op == ir::Op::SetField) {
+                            rewritten = ir::Instr(ir::Op::Move);
+                            rewritten.dst = prefix + instr.name;
+                            rewritten.a = instr.b;
+                        }
+                        flow.step(instr, holds);
+                        // copies of the object itself go away
+                        if (!(instr.op == ir::Op::Move && object == Holds::Current)) {
+                            code.push_back(rewritten);
+                        }
+                    }
+                    block.code = code;
+                }
+                // after the rewriting, which numbers the variables as the analysis did
+                for (Symbol field : layout.fields) {
+                    function.add_var(ir::Var{prefix + field.str(), ir::Rep::Object, false,
+                                             "field " + field.str() + " of a " + layout.name.str()});
+                }
+                stats.replaced++;
+            }
+            // the replaced objects' variables, and copies of them
+            function.drop_unused_vars();
+        }
+    }
+
+    /* Built-in methods with no effect but their result, which we can
+     * call before a loop even if the loop then never runs.  Not
+     * Int:DIVIDE, which can trap.
+     */
+    static const std::set<std::string> pure_builtins = {
+            "Obj_method_STRING", "Obj_method_EQUALS",
+            "String_method_STRING", "String_method_EQUALS", "String_method_LESS", "String_method_PLUS",
+            "Boolean_method_STRING", "Nothing_method_STRING",
+            "Int_method_STRING", "Int_method_EQUALS", "Int_method_LESS", "Int_method_PLUS",
+            "Int_method_MINUS", "Int_method_TIMES", "Int_method_MORE", "Int_method_ATLEAST", "Int_method_ATMOST"
+    };
+
+    static bool pure(const ir::Instr &instr) {
+        switch (instr.op) {
+            case ir::Op::Not:
+            case ir::Op::Box:
+            case ir::Op::Unbox:
+                return true;
+            case ir::Op::Arith:
+                return instr.name != "/";
+            case ir::Op::Call:
+                return instr.type != types::Unset && pure_builtins.count(instr.name) != 0;
+            default:
+                return false;
+        }
+    }
+
+    // blocks[head..tail] of a function, where tail jumps back to head
+    struct Loop {
+        size_t head;
+        size_t tail;
+    };
+
+    /* Code generation lays out the blocks of a loop together, and the
+     * only jump back to an earlier block is the one that repeats a
+     * loop; the smallest loop we have not done yet is an innermost one.
+     */
+    static bool next_loop(const ir::Function &function, const std::set<std::string> &done, Loop &loop) {
+        std::map<std::string, size_t> index;
+        for (size_t i = 0; i < function.blocks.size(); i++) {
+            index[function.blocks[i].label] = i;
+        }
+        bool found = false;
+        for (size_t tail = 0; tail < function.blocks.size(); tail++) {
+            for (const std::string &label : successors(function.blocks[tail])) {
+                auto head = index.find(label);
+                if (head == index.end() || head->second > tail || done.count(label) != 0) {
+                    continue;
+                }
+                if (!found || tail - head->second < loop.tail - loop.head) {
+                    loop = Loop{head->second, tail};
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    /* One loop.  Moving an instruction out is not always allowed here
+     * (temporaries are shared between statements, so its result may be
+     * set elsewhere in the loop too), so it stays, copying a variable
+     * that the preheader, which runs just before the loop, computes.
+     */
+    class LoopOptimizer {
+        ir::Function &function;
+        Loop loop;
+        std::string prefix;
+        int vars = 0;
+        std::set<std::string> defined;      // variables set somewhere in the loop
+        std::vector<ir::Instr> preheader;
+
+        // Going through one block: variables that hold what a preheader variable holds
+        std::map<std::string, std::string> same_as;
+        // ... and temporaries just set to a constant, not yet needed in the preheader
+        std::map<std::string, ir::Instr> constants;
+
+        std::string new_var(ir::Rep rep, std::string comment) {
+            std::string name = prefix + std::to_string(++vars);
+            function.add_var(ir::Var{name, rep, false, comment});
+            return name;
+        }
+
+        bool invariant(const std::string &var) const {
+            return var.empty() || same_as.count(var) != 0 || constants.count(var) != 0 || defined.count(var) == 0;
+        }
+
+        // The name of the value of 'var' in the preheader, if invariant
+        std::string early(const std::string &var) {
+            if (var.empty() || defined.count(var) == 0) {
+                return var;
+            }
+            auto constant = constants.find(var);
+            if (constant != constants.end()) {
+                ir::Instr copy = constant->second;
+                copy.dst = new_var(function.var(var)->rep, "constant");
+                preheader.push_back(copy);
+                same_as[var] = copy.dst;
+                constants.erase(constant);
+            }
+            return same_as.at(var);
+        }
+
+        void assigned(const std::string &var) {
+            same_as.erase(var);
+            constants.erase(var);
+        }
+
+    public:
+        LoopOptimizer(ir::Function &function, Loop loop, std::string prefix) :
+                function{function}, loop{loop}, prefix{prefix} {
+            for (size_t b = loop.head; b <= loop.tail; b++) {
+                for (const ir::Instr &instr : function.blocks[b].code) {
+                    if (!instr.dst.empty()) {
+                        defined.insert(instr.dst);
+                    }
+                }
+            }
+        }
+
+        void hoist_invariants(Stats &stats) {
+            for (size_t b = loop.head; b <= loop.tail; b++) {
+                same_as.clear();
+                constants.clear();
+                std::vector<ir::Instr> &code = function.blocks[b].code;
+                for (size_t n = 0; n < code.size(); n++) {
+                    ir::Instr &instr = code[n];
+                    if (instr.dst.empty()) {
+                        continue;
+                    }
+                    std::vector<std::string> used = instr.uses();
+                    bool movable = pure(instr)
+                                   && std::all_of(used.begin(), used.end(),
+                                                  [this](const std::string &v) { return invariant(v); });
+                    if (movable) {
+                        std::string dst = instr.dst;
+                        ir::Instr copy = instr;
+                        copy.a = early(instr.a);
+                        copy.b = early(instr.b);
+                        for (std::string &arg : copy.args) {
+                            arg = early(arg);
+                        }
+                        copy.dst = new_var(function.var(dst)->rep, "loop invariant");
+                        preheader.push_back(copy);
+                        instr = ir::Instr(ir::Op::Move);
+                        instr.dst = dst;
+                        instr.a = copy.dst;
+                        assigned(dst);
+                        same_as[dst] = copy.dst;
+                        stats.hoisted++;
+                        for (const std::string &var : used) {
+                            n -= drop_dead_load(b, n, var);
+                        }
+                        continue;
+                    }
+                    std::string source = instr.op == ir::Op::Move && invariant(instr.a) ? instr.a : "";
+                    ir::Instr constant = instr;
+                    assigned(instr.dst);
+                    if (instr.op == ir::Op::IntConst || instr.op == ir::Op::Literal) {
+                        constants.insert(std::make_pair(instr.dst, constant));
+                    } else if (!source.empty() && source != instr.dst) {
+                        if (constants.count(source) != 0) {
+                            ir::Instr value = constants.at(source);
+                            value.dst = instr.dst;
+                            constants.insert(std::make_pair(instr.dst, value));
+                        } else {
+                            same_as[instr.dst] = same_as.count(source) != 0 ? same_as[source] : source;
+                        }
+                    }
+                }
+            }
+        }
+
+        /* An induction variable: an Int variable i that the loop sets in
+         * one place only, to t after t = x + c (or x - c), where x is a
+         * copy of i and c a constant.  Each product i * k, with k the same
+         * on every trip, can be kept in a variable that starts out as
+         * i * k and goes up by c * k right after i goes up by c.  The
+         * product is also worked out for values of i the source never
+         * multiplies (before a loop that does not run, after its last
+         * trip), so it wraps around rather than overflow.
+         */
+        struct Induction {
+            long step;
+            size_t block;     // where i is set
+            size_t index;
+        };
+
+        // Going through a block: copies of variables, and temporaries holding constants
+        struct Values {
+            std::map<std::string, std::string> copy_of;
+            std::map<std::string, long> constant;
+            std::set<std::string> kept;     // variables to see as themselves even when set by a copy
+
+            std::string source(const std::string &var) const {
+                auto found = copy_of.find(var);
+                return found == copy_of.end() ? var : found->second;
+            }
+
+            void after(const ir::Instr &instr) {
+                if (instr.dst.empty()) {
+                    return;
+                }
+                for (auto it = copy_of.begin(); it != copy_of.end();) {
+                    it = it->second == instr.dst ? copy_of.erase(it) : std::next(it);
+                }
+                copy_of.erase(instr.dst);
+                constant.erase(instr.dst);
+                if (instr.op == ir::Op::Move && instr.a != instr.dst && kept.count(instr.dst) == 0) {
+                    copy_of[instr.dst] = source(instr.a);
+                } else if (instr.op == ir::Op::IntConst) {
+                    constant[instr.dst] = instr.value;
+                }
+            }
+        };
+
+        std::map<std::string, Induction> induction_variables() {
+            std::map<std::string, int> sets;
+            for (size_t b = loop.head; b <= loop.tail; b++) {
+                for (const ir::Instr &instr : function.blocks[b].code) {
+                    if (!instr.dst.empty()) {
+                        sets[instr.dst]++;
+                    }
+                }
+            }
+            std::map<std::string, Induction> found;
+            for (size_t b = loop.head; b <= loop.tail; b++) {
+                const std::vector<ir::Instr> &code = function.blocks[b].code;
+                Values values;
+                std::map<std::string, std::pair<std::string, long>> increments;   // t -> (i, c)
+                for (size_t n = 0; n < code.size(); n++) {
+                    const ir::Instr &instr = code[n];
+                    if (instr.op == ir::Op::Move && increments.count(instr.a) != 0
+                        && increments[instr.a].first == instr.dst && sets[instr.dst] == 1) {
+                        found[instr.dst] = Induction{increments[instr.a].second, b, n};
+                    }
+                    for (auto it = increments.begin(); it != increments.end();) {
+                        it = it->first == instr.dst || it->second.first == instr.dst ? increments.erase(it) : std::next(it);
+                    }
+                    if (instr.op == ir::Op::Arith && (instr.name == "+" || instr.name == "-")) {
+                        const ir::Var *i = function.var(values.source(instr.a));
+                        auto c = values.constant.find(instr.b);
+                        if (i != nullptr && i->rep == ir::Rep::Int && !i->param && c != values.constant.end()) {
+                            increments[instr.dst] = std::make_pair(i->name, instr.name == "+" ? c->second : -c->second);
+                        }
+                    }
+                    values.after(instr);
+                }
+            }
+            return found;
+        }
+
+        void reduce_strength(Stats &stats) {
+            std::map<std::string, Induction> ivs = induction_variables();
+            if (ivs.empty()) {
+                return;
+            }
+            std::map<std::string, std::string> reduced;    // "i*k" -> its variable
+            // updates to put in after each induction variable is set
+            std::map<std::pair<size_t, size_t>, std::vector<ir::Instr>> updates;
+            // what each product replaced read, by block, in order
+            std::map<size_t, std::vector<std::vector<std::string>>> operands;
+            for (size_t b = loop.head; b <= loop.tail; b++) {
+                Values values;
+                // after i = t, a copy of i is a copy of i (which the product follows), not of t
+                for (const std::pair<const std::string, Induction> &iv : ivs) {
+                    values.kept.insert(iv.first);
+                }
+                for (ir::Instr &instr : function.blocks[b].code) {
+                    ir::Instr original = instr;
+                    if (instr.op == ir::Op::Arith && instr.name == "*") {
+                        std::string p = values.source(instr.a);
+                        std::string q = values.source(instr.b);
+                        if (ivs.count(p) == 0) {
+                            std::swap(p, q);
+                        }
+                        auto iv = ivs.find(p);
+                        bool k_constant = values.constant.count(q) != 0;
+                        if (iv != ivs.end() && (k_constant || defined.count(q) == 0)) {
+                            std::string k = k_constant ? std::to_string(values.constant.at(q)) : q;
+                            std::string &var = reduced[p + "*" + k];
+                            if (var.empty()) {
+                                var = start_reduced(p, iv->second, k_constant ? "" : q,
+                                                    k_constant ? values.constant.at(q) : 0, updates);
+                            }
+                            instr = ir::Instr(ir::Op::Move);
+                            instr.dst = original.dst;
+                            instr.a = var;
+                            operands[b].push_back(original.uses());
+                            stats.reduced++;
+                        }
+                    }
+                    values.after(original);
+                }
+            }
+            // from the end of each block, so the places found stay right
+            for (auto it = updates.rbegin(); it != updates.rend(); ++it) {
+                std::vector<ir::Instr> &code = function.blocks[it->first.first].code;
+                code.insert(code.begin() + it->first.second + 1, it->second.begin(), it->second.end());
+            }
+            std::set<std::string> products;
+            for (const std::pair<const std::string, std::string> &product : reduced) {
+                products.insert(product.second);
+            }
+            for (const std::pair<const size_t, std::vector<std::vector<std::string>>> &block : operands) {
+                std::vector<ir::Instr> &code = function.blocks[block.first].code;
+                size_t k = 0;
+                for (size_t n = 0; n < code.size() && k < block.second.size(); n++) {
+                    if (code[n].op == ir::Op::Move && products.count(code[n].a) != 0) {
+                        for (const std::string &var : block.second[k]) {
+                            n -= drop_dead_load(block.first, n, var);
+                        }
+                        k++;
+                    }
+                }
+            }
+        }
+
+        // Whether some path from the start of the block 'label' reads 'var' before setting it
+        bool live_at(const std::string &label, const std::string &var) const {
+            std::map<std::string, size_t> index;
+            for (size_t i = 0; i < function.blocks.size(); i++) {
+                index[function.blocks[i].label] = i;
+            }
+            std::set<size_t> seen{index.at(label)};
+            std::vector<size_t> work{index.at(label)};
+            while (!work.empty()) {
+                const ir::Block &block = function.blocks[work.back()];
+                work.pop_back();
+                bool set = false;
+                for (const ir::Instr &instr : block.code) {
+                    std::vector<std::string> used = instr.uses();
+                    if (std::find(used.begin(), used.end(), var) != used.end()) {
+                        return true;
+                    }
+                    if (instr.dst == var) {
+                        set = true;
+                        break;
+                    }
+                }
+                if (set) {
+                    continue;
+                }
+                if (!block.terminated()) {
+                    return true;
+                }
+                for (const std::string &target : successors(block)) {
+                    size_t next = index.at(target);
+                    if (seen.insert(next).second) {
+                        work.push_back(next);
+                    }
+                }
+            }
+            return false;
+        }
+
+        /* Take out the load of 'var' that code[n] of block b read before
+         * it was hoisted or reduced, if nothing reads it any more: no path
+         * from there reads it before setting it again.  How many
+         * instructions went.
+         */
+        size_t drop_dead_load(size_t b, size_t n, const std::string &var) {
+            std::vector<ir::Instr> &code = function.blocks[b].code;
+            size_t d = n;
+            while (d > 0 && code[d - 1].dst != var) {
+                d--;
+            }
+            if (d == 0) {
+                return 0;
+            }
+            d--;
+            ir::Op op = code[d].op;
+            if (op != ir::Op::Move && op != ir::Op::IntConst && op != ir::Op::Literal) {
+                return 0;
+            }
+            auto reads = [&var](const ir::Instr &instr) {
+                std::vector<std::string> used = instr.uses();
+                return std::find(used.begin(), used.end(), var) != used.end();
+            };
+            for (size_t m = d + 1; m < code.size(); m++) {
+                if (reads(code[m])) {
+                    return 0;
+                }
+                if (code[m].dst == var) {
+                    code.erase(code.begin() + d);
+                    return 1;
+                }
+            }
+            if (!function.blocks[b].terminated()) {
+                return 0;
+            }
+            for (const std::string &label : successors(function.blocks[b])) {
+                if (live_at(label, var)) {
+                    return 0;
+                }
+            }
+            code.erase(code.begin() + d);
+            return 1;
+        }
+
+        // The variable for i * k, k a variable or else the constant k_value
+        std::string start_reduced(const std::string &i, const Induction &iv, const std::string &k, long k_value,
+                                  std::map<std::pair<size_t, size_t>, std::vector<ir::Instr>> &updates) {
+            std::string product = new_var(ir::Rep::Int, i + " times " + (k.empty() ? std::to_string(k_value) : k));
+            std::string factor = k;
+            if (factor.empty()) {
+                factor = new_var(ir::Rep::Int, "constant");
+                ir::Instr value(ir::Op::IntConst);
+                value.dst = factor;
+                value.value = k_value;
+                preheader.push_back(value);
+            }
+            ir::Instr start(ir::Op::Arith);
+            start.dst = product;
+            start.name = "*";
+            start.wraps = true;
+            start.a = i;
+            start.b = factor;
+            preheader.push_back(start);
+            ir::Instr c(ir::Op::IntConst);
+            c.dst = new_var(ir::Rep::Int, "constant");
+            c.value = iv.step;
+            preheader.push_back(c);
+            ir::Instr step(ir::Op::Arith);
+            step.dst = new_var(ir::Rep::Int, "step of " + product);
+            step.name = "*";
+            step.wraps = true;
+            step.a = factor;
+            step.b = c.dst;
+            preheader.push_back(step);
+            ir::Instr update(ir::Op::Arith);
+            update.dst = product;
+            update.name = "+";
+            update.wraps = true;
+            update.a = product;
+            update.b = step.dst;
+            updates[std::make_pair(iv.block, iv.index)].push_back(update);
+            return product;
+        }
+
+        // Put the preheader in, just before the loop, and send the way into the loop through it
+        void place_preheader() {
+            if (preheader.empty()) {
+                return;
+            }
+            std::string head = function.blocks[loop.head].label;
+            std::string label = prefix + "pre";
+            for (size_t b = 0; b < function.blocks.size(); b++) {
+                if (b >= loop.head && b <= loop.tail) {
+                    continue;
+                }
+                ir::Block &block = function.blocks[b];
+                if (block.terminated()) {
+                    ir::Instr &last = block.code.back();
+                    if (last.target == head) last.target = label;
+                    if (last.other == head) last.other = label;
+                }
+            }
+            ir::Instr jump(ir::Op::Jump);
+            jump.target = head;
+            preheader.push_back(jump);
+            function.blocks.insert(function.blocks.begin() + loop.head, ir::Block{label, preheader});
+        }
+    };
+
+    void optimize_loops(ir::Module &module, Stats &stats) {
+        int loops = 0;
+        for (ir::Function &function : module.functions) {
+            std::set<std::string> done;
+            Loop loop{0, 0};
+            while (next_loop(function, done, loop)) {
+                done.insert(function.blocks[loop.head].label);
+                LoopOptimizer optimizer(function, loop, "loop" + std::to_string(++loops) + "_");
+                optimizer.hoist_invariants(stats);
+                optimizer.reduce_strength(stats);
+                optimizer.place_preheader();
+            }
+            // the temporaries only the hoisted and reduced instructions read
+            function.drop_unused_vars();
+        }
+    }
+
+}
@@ -0,0 +1,64 @@
+//
+// Optimization passes over the IR (IR.h), run on the whole program
+// after code generation has built it (CodegenContext) and before the
+// C backend prints it.  A pass may use what the static semantics
+// worked out (class layouts, the class hierarchy), but knows nothing
+// about C.
+//
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include <ostream>
+#include "IR.h"
+
+class StaticSemantics;
+
+namespace opt {
+
+    // What the passes did, for the -s statistics
+    struct Stats {
+        int sends = 0;          // method calls through a method table
+        int direct = 0;         // ... made plain calls of a known function
+        int inlined = 0;        // calls replaced by the body of the function called
+        int allocs = 0;         // objects made
+        int replaced = 0;       // ... kept in variables instead (scalar_replace)
+        int hoisted = 0;        // computations moved out of loops (optimize_loops)
+        int reduced = 0;        // multiplications in loops made additions
+
+        void report(std::ostream &out);
+    };
+
+    /* Class-hierarchy analysis: the program is closed, so for each call
+     * we know every class the receiver can be.  If none of them has its
+     * own version of the method, the call can only reach one function.
+     */
+    void devirtualize(ir::Module &module, StaticSemantics *ss, Stats &stats);
+
+    // The default for -finline-limit
+    const int DEFAULT_INLINE_LIMIT = 12;
+
+    /* Replace a call of a known constructor or method by its body, if
+     * that is at most 'limit' instructions (0: no inlining).  Run after
+     * devirtualize, which makes method calls known calls.
+     */
+    void inline_calls(ir::Module &module, int limit, Stats &stats);
+
+    /* Escape analysis: an object that never leaves the function that
+     * makes it, and is only used for its fields, needs no allocation.
+     * Its fields become variables of the function.  Run after
+     * inline_calls, which brings constructors into the caller.
+     */
+    void scalar_replace(ir::Module &module, StaticSemantics *ss, Stats &stats);
+
+    /* In each loop, innermost first: compute what is the same on every
+     * trip (C int arithmetic, boxing, built-in methods of Int, String and
+     * Boolean) once before the loop, and turn i * k, with i an Int
+     * variable that goes up or down by a constant, into a variable that
+     * goes up or down by that constant times k.
+     */
+    void optimize_loops(ir::Module &module, Stats &stats);
+
+}
+
+#endif //OPTIMIZE_H
@@ -0,0 +1,202 @@
+//
+// Scope chains for the static semantics passes.
+//
+// Checking an 'if' or a 'while' used to clone the whole table of
+// variables for each branch.  Instead we keep one table and an undo
+// log: entering a scope marks the log, leaving it takes back exactly
+// the entries that were changed since the mark.  Cost is proportional
+// to what the branch did, not to the number of variables in scope.
+//
+
+#ifndef SCOPES_H
+#define SCOPES_H
+
+#include <functional>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <vector>
+#include "Symbols.h"
+#include "Types.h"
+
+/* The names that are known to be initialized (init_check) */
+class ScopedSet {
+    std::unordered_set<Symbol> names_;
+    std::vector<Symbol> added_;   // undo log: names in the order they were added
+    std::vector<size_t> marks_;   // where each open scope starts in the log
+
+public:
+    bool contains(Symbol name) const { return names_.count(name) != 0; }
+
+    void insert(Symbol name) {
+        if (names_.insert(name).second) {
+            added_.push_back(name);
+        }
+    }
+
+    // open a scope; everything inserted from now on is taken back by pop
+    void push() { marks_.push_back(added_.size()); }
+
+    /* close the innermost scope, returning the names it added
+     * (so that, e.g., 'if' can keep those both branches added)
+     */
+    std::vector<Symbol> pop() {
+        size_t mark = marks_.back();
+        marks_.pop_back();
+        std::vector<Symbol> taken(added_.begin() + mark, added_.end());
+        for (Symbol name : taken) {
+            names_.erase(name);
+        }
+        added_.resize(mark);
+        return taken;
+    }
+};
+
+/* The static types of variables (type_infer).  The table itself
+ * belongs to someone else (a method, a constructor, a class's instance
+ * variables); the environment edits it in place and remembers, for
+ * each open scope, what the table held before.  It can also keep a
+ * second table that nothing is ever taken back from: the join of every
+ * type each variable had, in any scope.
+ */
+class TypeEnv {
+public:
+    typedef std::map<Symbol, TypeId> Table;
+
+    // The outcome of a closed scope: the final type of each variable it changed
+    struct Binding {
+        Symbol name;
+        TypeId type;
+        bool existed;   // the variable was already there when the scope opened
+    };
+    typedef std::vector<Binding> Branch;
+
+private:
+    struct Undo {
+        Symbol name;
+        bool existed;
+        TypeId old_type;
+    };
+
+    Table *vars_;
+    std::vector<Undo> log_;
+    std::vector<size_t> marks_;
+    Table *all_scopes_ = nullptr;
+    std::function<TypeId(TypeId, TypeId)> lca_;
+
+public:
+    explicit TypeEnv(Table *vars) : vars_{vars} {}
+
+    // 'all_scopes' starts out as a copy of 'vars'
+    template<class Join>
+    TypeEnv(Table *vars, Table *all_scopes, Join lca) : vars_{vars}, all_scopes_{all_scopes}, lca_{lca} {
+        *all_scopes_ = *vars_;
+    }
+
+    TypeEnv(const TypeEnv&) = delete;
+    TypeEnv& operator=(const TypeEnv&) = delete;
+
+    bool contains(Symbol name) const { return vars_->count(name) != 0; }
+
+    // the type of a variable, or nullptr if it has none
+    const TypeId *find(Symbol name) const {
+        auto found = vars_->find(name);
+        return found == vars_->end() ? nullptr : &found->second;
+    }
+
+    void set(Symbol name, TypeId type) {
+        if (all_scopes_ != nullptr) {
+            auto seen = all_scopes_->find(name);
+            if (seen == all_scopes_->end()) {
+                all_scopes_->insert(std::make_pair(name, type));
+            } else {
+                seen->second = lca_(seen->second, type);
+            }
+        }
+        auto found = vars_->find(name);
+        if (found == vars_->end()) {
+            if (!marks_.empty()) {
+                log_.push_back(Undo{name, false, types::Unset});
+            }
+            vars_->insert(std::make_pair(name, type));
+        } else if (found->second != type) {
+            if (!marks_.empty()) {
+                log_.push_back(Undo{name, true, found->second});
+            }
+            found->second = type;
+        }
+    }
+
+    Table::const_iterator begin() const { return vars_->begin(); }
+    Table::const_iterator end() const { return vars_->end(); }
+
+    // open a scope, e.g., for one branch of an 'if'
+    void push() { marks_.push_back(log_.size()); }
+
+    /* Close the innermost scope: the table goes back to what it was
+     * when the scope opened, and we get what the scope changed.
+     */
+    Branch pop() {
+        size_t mark = marks_.back();
+        marks_.pop_back();
+        Branch branch;
+        std::set<Symbol> seen;
+        for (size_t i = mark; i < log_.size(); i++) {
+            if (seen.insert(log_[i].name).second) {
+                branch.push_back(Binding{log_[i].name, vars_->at(log_[i].name), log_[i].existed});
+            }
+        }
+        for (size_t i = log_.size(); i > mark; i--) {
+            const Undo &undo = log_[i - 1];
+            if (undo.existed) {
+                (*vars_)[undo.name] = undo.old_type;
+            } else {
+                vars_->erase(undo.name);
+            }
+        }
+        log_.resize(mark);
+        return branch;
+    }
+
+    /* Merge branches that rejoin, only touching variables some branch
+     * changed.  A variable that was there before gets the join of its
+     * type on every path (a path that did not change it keeps the type
+     * it had); a new variable survives only if every branch defined it.
+     * If 'fall_through' there is also a path that took no branch at all,
+     * as for a 'while' that runs zero times.  Returns true if a variable
+     * that was already there changed type.
+     */
+    template<class Join>
+    bool join(const std::vector<Branch> &branches, bool fall_through, Join lca) {
+        std::map<Symbol, std::vector<const Binding *> > changed;
+        for (const Branch &branch : branches) {
+            for (const Binding &binding : branch) {
+                changed[binding.name].push_back(&binding);
+            }
+        }
+        bool widened = false;
+        for (const std::pair<const Symbol, std::vector<const Binding *> > &var : changed) {
+            const std::vector<const Binding *> &bindings = var.second;
+            bool every_path = !fall_through && bindings.size() == branches.size();
+            bool existed = bindings.front()->existed;
+            if (!existed && !every_path) {
+                continue; // not defined on every path
+            }
+            TypeId type = bindings.front()->type;
+            for (const Binding *binding : bindings) {
+                type = lca(type, binding->type);
+            }
+            if (existed) {
+                TypeId before = vars_->at(var.first);
+                if (!every_path) {
+                    type = lca(type, before);
+                }
+                widened = widened || type != before;
+            }
+            set(var.first, type);
+        }
+        return widened;
+    }
+};
+
+#endif //SCOPES_H
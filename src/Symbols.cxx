@@ -0,0 +1,103 @@
+//
+// The global symbol table behind Symbol::intern.
+//
+
+#include "Symbols.h"
+
+#include <atomic>
+#include <cassert>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+    /* Texts of the predefined symbols, in the order of their
+     * handles in Symbols.h.
+     */
+    const char *BUILTIN_NAMES[sym::N_BUILTIN] = {
+            "",
+            "Obj", "Int", "String", "Boolean", "Nothing", "Top", "None",
+            "Ok",
+            "none", "true", "false", "True", "False", "this",
+            "PLUS", "MINUS", "TIMES", "DIVIDE", "PRINT", "STR", "STRING", "EQUALS",
+            "ATMOST", "ATLEAST", "<", ">",
+            "$main", "$meth"
+    };
+
+    /* Names are written once, under the lock, and read without it:
+     * inference units print symbols from every thread of the pool.
+     * The texts live in fixed-size chunks that never move, found through
+     * a directory that never grows, and a name is published by storing
+     * the new size with release order after the text is in place.
+     */
+    class SymbolTable {
+        static const int CHUNK_BITS = 10;
+        static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+        static const int MAX_CHUNKS = 4096;     // about four million names
+        std::atomic<std::string *> chunks_[MAX_CHUNKS];
+        std::atomic<int> size_{0};
+        std::unordered_map<std::string, int> ids_;
+        std::mutex lock_;     // for intern only
+    public:
+        SymbolTable() {
+            for (std::atomic<std::string *> &chunk : chunks_) {
+                chunk.store(nullptr, std::memory_order_relaxed);
+            }
+            for (const char *name : BUILTIN_NAMES) {
+                intern(name);
+            }
+        }
+
+        ~SymbolTable() {
+            for (std::atomic<std::string *> &chunk : chunks_) {
+                delete[] chunk.load(std::memory_order_relaxed);
+            }
+        }
+
+        int intern(const std::string &text) {
+            std::lock_guard<std::mutex> guard(lock_);
+            auto found = ids_.find(text);
+            if (found != ids_.end()) {
+                return found->second;
+            }
+            int id = size_.load(std::memory_order_relaxed);
+            assert(id < MAX_CHUNKS * CHUNK_SIZE);
+            std::atomic<std::string *> &chunk = chunks_[id >> CHUNK_BITS];
+            if (chunk.load(std::memory_order_relaxed) == nullptr) {
+                chunk.store(new std::string[CHUNK_SIZE], std::memory_order_relaxed);
+            }
+            chunk.load(std::memory_order_relaxed)[id & (CHUNK_SIZE - 1)] = text;
+            ids_[text] = id;
+            size_.store(id + 1, std::memory_order_release);
+            return id;
+        }
+
+        const std::string &name(int id) const {
+            // pairs with the release in intern, so the text is there
+            int size = size_.load(std::memory_order_acquire);
+            assert(id >= 0 && id < size);
+            (void) size;
+            return chunks_[id >> CHUNK_BITS].load(std::memory_order_relaxed)[id & (CHUNK_SIZE - 1)];
+        }
+    };
+
+    /* Constructed on first use, because identifiers are created
+     * during static initialization (see ASTBuiltIns.cxx).
+     */
+    SymbolTable &table() {
+        static SymbolTable the_table;
+        return the_table;
+    }
+}
+
+Symbol Symbol::intern(const std::string &text) {
+    return Symbol{table().intern(text)};
+}
+
+Symbol Symbol::intern(const char *text) {
+    return Symbol{table().intern(std::string(text))};
+}
+
+const std::string &Symbol::str() const {
+    return table().name(id);
+}
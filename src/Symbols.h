@@ -0,0 +1,85 @@
+//
+// Interned symbols for identifiers, class names, method names
+// and type names.
+//
+// Every distinct name in the program is stored exactly once, in a
+// global table, and the rest of the compiler passes around a small
+// integer handle for it.  Two symbols are the same name if and only
+// if their handles are equal, so the tables in static semantics and
+// code generation compare integers rather than strings.
+//
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <string>
+#include <ostream>
+#include <functional>
+
+/* A Symbol is plain data (no constructors), so that it can travel
+ * in the bison %union alongside the other token values.
+ */
+struct Symbol {
+    int id;
+
+    /* The one and only Symbol for this text */
+    static Symbol intern(const std::string &text);
+    static Symbol intern(const char *text);
+
+    /* The text of the name, e.g., for error messages and generated code */
+    const std::string &str() const;
+
+    bool operator==(Symbol other) const { return id == other.id; }
+    bool operator!=(Symbol other) const { return id != other.id; }
+    bool operator<(Symbol other) const { return id < other.id; }
+};
+
+inline std::ostream &operator<<(std::ostream &out, Symbol sym) {
+    return out << sym.str();
+}
+
+namespace std {
+    template<>
+    struct hash<Symbol> {
+        size_t operator()(Symbol sym) const { return std::hash<int>()(sym.id); }
+    };
+}
+
+/* Names the compiler itself needs to know about.  The symbol table
+ * is seeded with these, in this order (see BUILTIN_NAMES in Symbols.cxx),
+ * so their handles are constants and never need to be looked up.
+ */
+namespace sym {
+    const Symbol EMPTY = {0};       // ""  (no name)
+    const Symbol Obj = {1};
+    const Symbol Int = {2};
+    const Symbol String = {3};
+    const Symbol Boolean = {4};
+    const Symbol Nothing = {5};
+    const Symbol Top = {6};
+    const Symbol None = {7};
+    const Symbol Ok = {8};          // result of checking a statement that has no type
+    const Symbol none = {9};
+    const Symbol true_ = {10};
+    const Symbol false_ = {11};
+    const Symbol True = {12};
+    const Symbol False = {13};
+    const Symbol this_ = {14};
+    const Symbol PLUS = {15};
+    const Symbol MINUS = {16};
+    const Symbol TIMES = {17};
+    const Symbol DIVIDE = {18};
+    const Symbol PRINT = {19};
+    const Symbol STR = {20};
+    const Symbol STRING = {21};
+    const Symbol EQUALS = {22};
+    const Symbol ATMOST = {23};
+    const Symbol ATLEAST = {24};
+    const Symbol LESS = {25};       // <
+    const Symbol MORE = {26};       // >
+    const Symbol main_class = {27}; // pseudo class for the main program
+    const Symbol main_method = {28}; // pseudo method for the main program
+    const int N_BUILTIN = 29;
+}
+
+#endif //SYMBOLS_H
@@ -0,0 +1,147 @@
+//
+// A small work-stealing thread pool.
+//
+// Static semantics hands the pool a batch of independent tasks (one
+// per constructor or method to check) and waits for all of them.
+// Each worker has its own queue and takes from the back of it; a
+// worker that runs dry steals from the front of another worker's
+// queue, so a few expensive methods do not leave the other cores idle.
+// The calling thread works on the batch too, so a pool of one thread
+// is just a plain loop.
+//
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+    struct Queue {
+        std::mutex lock;
+        std::deque<std::function<void()> > tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue> > queues_;  // one per worker, the caller is worker 0
+    std::vector<std::thread> threads_;
+    std::mutex lock_;
+    std::condition_variable work_ready_;
+    std::condition_variable batch_done_;
+    size_t pending_ = 0;        // tasks of the current batch not finished yet
+    unsigned generation_ = 0;   // bumped for every batch, to wake the workers
+    bool stopping_ = false;
+
+    // own queue first (newest task), then steal the oldest task of someone else
+    bool take(unsigned me, std::function<void()> &task) {
+        {
+            Queue &own = *queues_[me];
+            std::lock_guard<std::mutex> guard(own.lock);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (unsigned i = 1; i < queues_.size(); i++) {
+            Queue &victim = *queues_[(me + i) % queues_.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void drain(unsigned me) {
+        std::function<void()> task;
+        while (take(me, task)) {
+            task();
+            std::lock_guard<std::mutex> guard(lock_);
+            if (--pending_ == 0) {
+                batch_done_.notify_all();
+            }
+        }
+    }
+
+    void worker(unsigned me) {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                work_ready_.wait(guard, [&] { return stopping_ || generation_ != seen; });
+                if (stopping_) {
+                    return;
+                }
+                seen = generation_;
+            }
+            drain(me);
+        }
+    }
+
+public:
+    // threads == 0 means one per core
+    explicit WorkStealingPool(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            queues_.emplace_back(new Queue());
+        }
+        for (unsigned i = 1; i < threads; i++) {
+            threads_.emplace_back(&WorkStealingPool::worker, this, i);
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stopping_ = true;
+        }
+        work_ready_.notify_all();
+        for (std::thread &t : threads_) {
+            t.join();
+        }
+    }
+
+    unsigned size() const { return (unsigned) queues_.size(); }
+
+    /* Run every task and return once all of them are done.  Tasks
+     * must not throw.  The order they run in is up to the pool.
+     */
+    void run_all(std::vector<std::function<void()> > &tasks) {
+        if (tasks.empty()) {
+            return;
+        }
+        {
+            // counted before queueing, a worker may pick up a task right away
+            std::lock_guard<std::mutex> guard(lock_);
+            pending_ = tasks.size();
+        }
+        for (size_t i = 0; i < tasks.size(); i++) {
+            Queue &q = *queues_[i % queues_.size()];
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.tasks.push_back(std::move(tasks[i]));
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            generation_++;
+        }
+        work_ready_.notify_all();
+        drain(0);
+        std::unique_lock<std::mutex> guard(lock_);
+        batch_done_.wait(guard, [&] { return pending_ == 0; });
+    }
+};
+
+#endif //THREADPOOL_H
@@ -0,0 +1,34 @@
+//
+// Static types for type inference.
+//
+// A static type is a dense integer class ID.  StaticSemantics assigns
+// the IDs once the class hierarchy is sorted; the built-in classes
+// always get the same IDs so the checker can name them directly.
+// Two types are the same if and only if their IDs are equal.
+//
+
+#ifndef TYPES_H
+#define TYPES_H
+
+typedef int TypeId;
+
+namespace types {
+    /* Results of checking that are not classes */
+    const TypeId Unset = -2;   // No type (yet), e.g., a call to an unknown method
+    const TypeId Ok = -1;      // A statement that checked without error
+
+    /* Reserved class IDs */
+    const TypeId Top = 0;      // Type error / no common ancestor
+    const TypeId Nothing = 1;
+    const TypeId Obj = 2;
+    const TypeId Int = 3;
+    const TypeId String = 4;
+    const TypeId Boolean = 5;
+
+    /* User classes are numbered from here, in topological order */
+    const TypeId FIRST_USER_CLASS = 6;
+
+    inline bool is_class(TypeId t) { return t >= Nothing; }
+}
+
+#endif //TYPES_H
@@ -8,6 +8,8 @@
 #include "Messages.h"
 #include "staticsemantics.cpp"
 #include "CodegenContext.h"
+#include "Optimize.h"
+#include "CBackend.h"
 
 #include <iostream>
 #include <unistd.h>  // getopt is here
@@ -15,12 +17,19 @@
 class Driver {
     int debug_level = 0;
 public:
-    explicit Driver(const reflex::Input in) : lexer(in), parser(new yy::parser(lexer, &root)) { root = nullptr; }
+    explicit Driver(const reflex::Input in) : lexer(in), parser(new yy::parser(lexer, &root, arena)) { root = nullptr; }
 
     ~Driver() { delete parser; }
 
     void debug() { debug_level = 1; }
 
+    /* How much did building the tree cost us? */
+    void report_allocations(std::ostream &out) {
+        out << "Parse allocations: " << arena.nodes_allocated << " nodes, "
+            << arena.bytes_allocated << " bytes, "
+            << arena.chunks_allocated << " mallocs" << std::endl;
+    }
+
     AST::ASTNode *parse() {
         parser->set_debug_level(debug_level); // 0 = no debugging, 1 = full tracing
         // std::cout << "Running parser\n";
@@ -38,6 +47,7 @@ public:
     }
 
 private:
+    AST::Arena arena;   // Owns every node of the tree, so the tree lives as long as the Driver
     yy::Lexer lexer;
     yy::parser *parser;
     AST::ASTNode *root;
@@ -48,13 +58,30 @@ int main(int argc, char **argv) {
     char c;
     FILE *f;
     int index;
-    int debug; // 0 = no debugging, 1 = full tracing
+    int debug = 0; // 0 = no debugging, 1 = full tracing
+    int stats = 0; // 1 = report parse allocation counts and codegen temporaries
+    unsigned threads = 0; // for type inference, 0 = one per core
+    int inline_limit = opt::DEFAULT_INLINE_LIMIT; // -finline-limit=N, in IR instructions
 
-    while ((c = getopt(argc, argv, "t")) != -1) {
+    while ((c = getopt(argc, argv, "tsj:f:")) != -1) {
         if (c == 't') {
             std::cerr <<  "Debugging mode\n";
             debug = 1;
         }
+        if (c == 's') {
+            stats = 1;
+        }
+        if (c == 'j') {
+            threads = (unsigned) atoi(optarg);
+        }
+        if (c == 'f') {
+            std::string flag = optarg;
+            if (flag.compare(0, 13, "inline-limit=") == 0) {
+                inline_limit = atoi(flag.c_str() + 13);
+            } else {
+                std::cerr << "Unknown option -f" << flag << "\n";
+            }
+        }
     }
 
     for (index = optind; index < argc; ++index) {
@@ -65,6 +92,7 @@ int main(int argc, char **argv) {
         Driver driver(f);
         if (debug) driver.debug();
         AST::ASTNode *root = driver.parse();
+        if (stats) driver.report_allocations(std::cerr);
         if (root != nullptr) {
             // std::cout << "Parsed!\n";
             AST::AST_print_context context;
@@ -72,28 +100,31 @@ int main(int argc, char **argv) {
             std::cout << std::endl;
             // call static semantic checker, pass in root
             // get a struct full of pointers to tables in return
-            StaticSemantics ssc(root);
+            StaticSemantics ssc(root, threads);
             // std::cout << "About to call the static semantic checker." << std::flush;
             tablepointers *result = ssc.check(root);
             if (result == nullptr ) {
                 std::cout << "Error while doing static semantic check." << std::endl;
             } else {
                 std::cout << "Success with the static semantics!!." << std::endl;
+                // constant expressions and dead branches, now that it all type checks
+                root->fold();
                 // generate code!
 
                 //void generate_code(AST::ASTNode *root) {
-                CodegenContext ctx(std::cout);
-                // Prologue
-                ctx.emit("#include <stdio.h>");
-                ctx.emit("#include \"Builtins.c\"");
-                ctx.emit("int main(int argc, char **argv) {");
-                // Body of generated code
-                std::string target = ctx.alloc_reg();
-                root->gen_rvalue(ctx, target);
-                // Coda
-//                ctx.emit(std::string(R"(printf("-> %d\n",)")
-//                         + target + ");");
-                ctx.emit("}");
+                ir::Module module;
+                CodegenContext ctx(module, &ssc);
+                ((AST::Program *) root)->gen_program(ctx);
+                opt::Stats optimized;
+                opt::devirtualize(module, &ssc, optimized);
+                opt::inline_calls(module, inline_limit, optimized);
+                opt::scalar_replace(module, &ssc, optimized);
+                opt::optimize_loops(module, optimized);
+                // Prologue, classes with their method tables, then the functions
+                CBackend backend(std::cout, &ssc);
+                backend.gen_module(module);
+                if (stats) ctx.report_temps(std::cerr);
+                if (stats) optimized.report(std::cerr);
               //  }
             }
         } else {
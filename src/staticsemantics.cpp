@@ -7,55 +7,52 @@
 #include <vector>
 #include <stack>
 #include <list>
+#include <deque>
+#include <set>
+#include <algorithm>
+#include <functional>
+#include <sstream>
 #include "string.h"
 #include "ASTNode.h"
 #include "ASTBuiltIns.h"
+#include "Types.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
+class StaticSemantics;
+
 class MethodNode {
 
 public:
-    string name;
-    string return_type;
-    string inherited_from;
+    Symbol name = sym::EMPTY;
+    TypeId return_type = types::Unset;
+    Symbol inherited_from = sym::EMPTY;
     //vector<string> formal_arg_types;
     // table of local variables (anything passed in, defined inside or class level instance vars)
-    map<string, string> local_vars;
+    map<Symbol, TypeId> local_vars;
 
     MethodNode() {
     }
 
-    MethodNode(AST::Method *method) {
-        name = method->name_.text_;
-
-        return_type = method->returns_.get_text();
-        local_vars = map<string, string>();
-        local_vars["True"] = "Boolean";
-        local_vars["False"] = "Boolean";
-        local_vars["true"] = "Boolean";
-        local_vars["false"] = "Boolean";
-
-        AST::Formals formals = method->formals_;
-        if (formals.elements_.size() != 0) {
-            vector<AST::Formal *> formal_list = formals.elements_;
-            for (AST::Formal *formal: formal_list) {
-                local_vars[formal->var_.str()] = formal->type_.str();
-            }
-        }
-    }
+    // Types of formals and the return type are resolved to class IDs,
+    // so this can only be called once the hierarchy is sorted.
+    MethodNode(AST::Method *method, StaticSemantics *ss);
 
 };
 
 // okay to build with minimal information now, as long as do a type inference/check topologically
 class ClassNode {
     public:
-        string name_;
+        Symbol name_ = sym::EMPTY;
         // keep track of parents for the class hierarchy
-        string parent_;
+        Symbol parent_ = sym::EMPTY;
+        // dense class IDs, assigned once the hierarchy is sorted
+        TypeId id_ = types::Top;
+        TypeId parent_id_ = types::Top;
         // attributes of the class (vars, methods)
-        map<string, string> instance_vars; // names of the variables,
-        map<string, MethodNode> methods;
+        map<Symbol, TypeId> instance_vars; // names of the variables,
+        map<Symbol, MethodNode> methods;
         // constructor
         MethodNode constructor_;
         bool visited;
@@ -66,18 +63,18 @@ class ClassNode {
         }
 
         //explicit ClassNode(string name, string parent):  name_{string::strdup(name)}, parent_{string::strdup(parent)}{ // constructor takes a name
-        ClassNode(string name, string parent) {
+        ClassNode(Symbol name, Symbol parent) {
             name_ = name;
             parent_ = parent;
             visited = false;
             resolved = false;
             constructor_ = MethodNode();
-            instance_vars = map<string, string>();
-            methods = map<string, MethodNode>();
+            instance_vars = map<Symbol, TypeId>();
+            methods = map<Symbol, MethodNode>();
         }
 
         // TODO do I need all these or should I just access the public fields and push later?
-        void add_parent(string parent) {
+        void add_parent(Symbol parent) {
             parent = parent;
         }
 
@@ -86,32 +83,120 @@ class ClassNode {
         }
 };
 
+/* One slot of a method table: the method, and the C function that
+ * implements it in this class (its own, or inherited).
+ */
+struct VtableSlot {
+    Symbol method;
+    std::string impl;
+    int arity;   // arguments, not counting the receiver
+};
+
+/* Where the methods and instance variables of a class live at run time.
+ * A subclass starts with the slots and the fields of its superclass, in
+ * the same places, so code compiled against the superclass works on
+ * objects of the subclass.  Slot 0 is always the constructor.
+ */
+struct ClassLayout {
+    Symbol name = sym::EMPTY;
+    bool builtin = false;
+    vector<VtableSlot> slots;
+    map<Symbol, int> slot_of;
+    vector<Symbol> fields;   // names of instance variables, without "this."
+
+    // the slot of a method, or -1 if the class has no such method
+    int slot(Symbol method) const {
+        auto found = slot_of.find(method);
+        return found == slot_of.end() ? -1 : found->second;
+    }
+
+    void add_slot(Symbol method, std::string impl, int arity) {
+        auto found = slot_of.find(method);
+        if (found != slot_of.end() && found->second != 0) {
+            slots[found->second].impl = impl;   // overridden
+            slots[found->second].arity = arity;
+        } else {
+            slot_of[method] = (int) slots.size();
+            slots.push_back(VtableSlot{method, impl, arity});
+        }
+    }
+};
+
 //struct for returning from the check() method
 struct tablepointers {
-    map<string, ClassNode> class_hierarchy;
-    map<string, string> *var_types;
+    map<Symbol, ClassNode> class_hierarchy;
+    map<Symbol, TypeId> *var_types;
 };
 
+/* One piece of type inference that can be redone on its own:
+ * a class constructor, a method, or the main program.  A unit keeps
+ * its own table of variables between runs, so running it again only
+ * ever widens what it already knew.
+ *
+ * Units of one round are checked in parallel, so while it runs a unit
+ * only writes to itself; the rest is copied back by merge_unit.
+ */
+struct InferUnit {
+    AST::Class *clazz = nullptr;       // constructor or method of this class
+    AST::Method *method = nullptr;     // nullptr for a constructor or the main program
+    AST::Program *program = nullptr;   // set only for the main program
+    Symbol class_name = sym::EMPTY;
+    Symbol method_name = sym::EMPTY;
+    map<Symbol, TypeId> context;       // variables of a method or the main program
+    map<Symbol, TypeId> all_scopes;    // each variable's type joined over all its scopes, for codegen
+    int stage = 0;                     // constructors, then methods, then the main program
+    bool queued = false;
+
+    // results of the last run, waiting to be merged
+    TypeId result = types::Ok;
+    bool changed = false;              // widened one of its own variables
+    map<Symbol, TypeId> fields;        // a constructor's instance variables
+    set<TypeId> reads;                 // classes whose instance variables it read
+    map<TypeId, map<Symbol, TypeId>> field_writes;   // instance variables it widened, by class
+    std::ostringstream *log = nullptr; // its messages, while it runs
+    std::string log_text;
+};
+
+// the unit this thread is checking, or nullptr outside of type inference
+inline InferUnit *&checking_unit() {
+    static thread_local InferUnit *unit = nullptr;
+    return unit;
+}
+
 class StaticSemantics {
 
 public:
     tablepointers tp;
     // hashtable for class hierarchy
-    map <string, ClassNode> class_hierarchy;
-    // once sorted
-    vector <ClassNode> sorted_classes;
+    map <Symbol, ClassNode> class_hierarchy;
+    // once sorted (superclasses first), pointing into class_hierarchy
+    vector <ClassNode*> sorted_classes;
+    // class ID -> class name and class node (Top is not a class, so it has no node)
+    vector <Symbol> type_names;
+    vector <ClassNode*> classes_by_id;
+    // depth below Obj and binary-lifting ancestors, by class ID (see build_hierarchy_index)
+    vector <int> depth_;
+    vector <TypeId> ancestor_;
+    int lift_levels_ = 0;
     // hashtable for variables and types - scopes!
-    map <string, string> var_types;
+    map <Symbol, TypeId> var_types;
     // indicates an error occurred sometime during static semantics check and should return nullptr
     bool error = false;
-    bool changed = true;
     AST::ASTNode * root;
-
-    StaticSemantics(AST::ASTNode *root) { // default constructor
+    // incremental type inference: units to (re)check, and who reads whose instance variables
+    vector <InferUnit> units;
+    deque <int> worklist;
+    map <TypeId, set<int> > field_readers;
+    unsigned threads = 0; // for checking units in parallel, 0 = one per core
+    // run-time layout of every class, by class ID (see build_layouts)
+    vector <ClassLayout> layouts;
+
+    StaticSemantics(AST::ASTNode *root, unsigned threads = 0) { // default constructor
         root = root;
-        class_hierarchy = map<string, ClassNode>();
-        sorted_classes = vector<ClassNode>();
-        var_types = map<string, string>();
+        this->threads = threads;
+        class_hierarchy = map<Symbol, ClassNode>();
+        sorted_classes = vector<ClassNode*>();
+        var_types = map<Symbol, TypeId>();
     }
 
     // A recursive function used by topologicalSort
@@ -127,13 +212,13 @@ public:
             return;
         }
         cn->visited = true;
-        string cur_parent = cn->parent_;
-        string cur_class = cn->name_;
+        Symbol cur_parent = cn->parent_;
+        Symbol cur_class = cn->name_;
         //std::cout << " Class " << cur_class << " getting sorted, parent: " << cur_parent<<endl;
         if (class_hierarchy.count(cur_parent)) {
             topologicalSortRec(&(class_hierarchy[cur_parent]));
             cn->resolved = true;
-            sorted_classes.push_back(*cn);
+            sorted_classes.push_back(cn);
         } else {
             std::cout << " Class " << cur_class << " extends undefined class " << cur_parent<<endl;
         }
@@ -161,6 +246,7 @@ public:
         if (error) {
             return nullptr;
         }
+        build_layouts(root);
 
         return &tp;
 
@@ -173,27 +259,26 @@ public:
         // cast root to a Program node
         AST::Program *root_node = (AST::Program*) root;
         // get the classes
-        AST::Classes classes = root_node->classes_;
-        vector<AST::Class *> class_list = classes.elements_;
+        AST::Classes &class_list = root_node->classes_;
         for (AST::Class *clazz: class_list) {
             // first pass just builds the classes as is
-            string cls_name = clazz->name_.text_;
-            string par_name = clazz->super_.text_;
+            Symbol cls_name = clazz->name_.sym_;
+            Symbol par_name = clazz->super_.sym_;
             //std::cout << " Class and PAR " << cls_name << par_name <<endl;
             ClassNode new_class = ClassNode(cls_name, par_name);
-
-            // populate all the things!
-            //AST::ASTNode *constr = &(clazz->constructor_);
-            AST::Method *constr = &(clazz->constructor_);
-            //AST::Method *construct = (AST::Method *) constr;
-            MethodNode constructor = MethodNode(constr);
-            new_class.constructor_ = constructor;
-            new_class.instance_vars = new_class.constructor_.local_vars; //constructors variables are the class level - need this?
-            new_class.add_method(&constructor);
+            // code generation keeps Ints and Booleans as plain C values and
+            // Strings as ropes, so a variable of one of these types must
+            // hold exactly that class
+            if (par_name == sym::Int || par_name == sym::Boolean || par_name == sym::String) {
+                std::cout << " Class " << cls_name << " extends built-in class " << par_name
+                          << ", which cannot be subclassed" << endl;
+                error = true;
+            }
+            // constructor and methods are filled in once class IDs are known
 //
 //            vector < AST::Method * > method_list = clazz->methods_.elements_;
 //            for (AST::Method *method: method_list) {
-//                MethodNode new_method = MethodNode(method);
+//                MethodNode new_method = MethodNode(method, this);
 //                new_class.add_method(new_method);
 //                std::cout << "Created method node with name: " << new_method.name << endl;
 //            }
@@ -204,108 +289,126 @@ public:
 
         // Create Built-In Classes
         // Obj Class
-        ClassNode obj_node = ClassNode("Obj", "None");
+        ClassNode obj_node = ClassNode(sym::Obj, sym::None);
         obj_node.visited = true;
         obj_node.resolved = true;
-        obj_node.constructor_.return_type = "Obj";
-        class_hierarchy["Obj"] = obj_node;
-        sorted_classes.push_back(obj_node);
+        obj_node.constructor_.return_type = types::Obj;
 
         // Obj Methods
         MethodNode printmn = MethodNode();
-        printmn.name = "PRINT";
-        printmn.return_type = "Nothing";
-        map<string, MethodNode>* obj_meths = &(obj_node.methods);
-        (*obj_meths)["PRINT"] = printmn;
+        printmn.name = sym::PRINT;
+        printmn.return_type = types::Nothing;
+        map<Symbol, MethodNode>* obj_meths = &(obj_node.methods);
+        (*obj_meths)[sym::PRINT] = printmn;
         MethodNode strmn = MethodNode();
-        strmn.name = "STR";
-        strmn.return_type = "String";
-        (*obj_meths)["STR"] = strmn;
+        strmn.name = sym::STR;
+        strmn.return_type = types::String;
+        (*obj_meths)[sym::STR] = strmn;
+        class_hierarchy[sym::Obj] = obj_node;   // after its methods: this is a copy
+        sorted_classes.push_back(&class_hierarchy[sym::Obj]);
 
         //String Class
-        ClassNode string_node = ClassNode("String", "Obj");
-        string_node.constructor_.return_type = "String";
-        class_hierarchy["String"] = string_node;
-        map<string, MethodNode>* string_meths = &(string_node.methods);
+        ClassNode string_node = ClassNode(sym::String, sym::Obj);
+        string_node.constructor_.return_type = types::String;
+        map<Symbol, MethodNode>* string_meths = &(string_node.methods);
 //        (string_node.methods)["PRINT"] = printmn;
 //        (string_node.methods)["STR"] = strmn;
         // String PLUS method (concatenation)
         MethodNode plusmn = MethodNode();
-        plusmn.name = "PLUS";
-        plusmn.return_type = "String";
-        (*string_meths)["PLUS"] = plusmn;
+        plusmn.name = sym::PLUS;
+        plusmn.return_type = types::String;
+        (*string_meths)[sym::PLUS] = plusmn;
+        // Comparisons
+        for (Symbol blt : vector<Symbol>{ sym::EQUALS, sym::LESS }) {
+            MethodNode mn = MethodNode();
+            mn.name = blt;
+            mn.return_type = types::Boolean;
+            (*string_meths)[blt] = mn;
+        }
+        class_hierarchy[sym::String] = string_node;   // after its methods: this is a copy
 
         //Boolean Class
-        ClassNode bool_node = ClassNode("Boolean", "Obj");
-        bool_node.constructor_.return_type = "Boolean";
-        class_hierarchy["Boolean"] = bool_node;
+        ClassNode bool_node = ClassNode(sym::Boolean, sym::Obj);
+        bool_node.constructor_.return_type = types::Boolean;
+        class_hierarchy[sym::Boolean] = bool_node;
 //        (bool_node.methods)["PRINT"] = printmn;
 //        (bool_node.methods)["STR"] = strmn;
 
         //Int Class
-        ClassNode int_node = ClassNode("Int", "Obj");
-        int_node.constructor_.return_type = "Int";
-        map<string, MethodNode>* int_meths = &(int_node.methods);
+        ClassNode int_node = ClassNode(sym::Int, sym::Obj);
+        int_node.constructor_.return_type = types::Int;
+        map<Symbol, MethodNode>* int_meths = &(int_node.methods);
 //        (int_node.methods)["PRINT"] = printmn;
 //        (int_node.methods)["STR"] = strmn;
 
         //Builtin Methods for Ints that return an Int
-        vector<string> intreturnvect{ "PLUS", "MINUS", "DIVIDE", "TIMES"};
-        for (string blt : intreturnvect){
+        vector<Symbol> intreturnvect{ sym::PLUS, sym::MINUS, sym::DIVIDE, sym::TIMES};
+        for (Symbol blt : intreturnvect){
             MethodNode mn = MethodNode();
             mn.name = blt;
-            mn.return_type = "Int";
+            mn.return_type = types::Int;
             (*int_meths)[blt] = mn;
         }
         //Builtin Methods for Ints that return a Boolean
-        vector<string> boolreturnvect{ ">", "<", "ATLEAST", "ATMOST", "EQUALS"};
-        for (string blt : boolreturnvect){
+        vector<Symbol> boolreturnvect{ sym::MORE, sym::LESS, sym::ATLEAST, sym::ATMOST, sym::EQUALS};
+        for (Symbol blt : boolreturnvect){
             MethodNode mn = MethodNode();
             mn.name = blt;
-            mn.return_type = "Boolean";
+            mn.return_type = types::Boolean;
             (*int_meths)[blt] = mn;
         }
-        class_hierarchy["Int"] = int_node;
+        class_hierarchy[sym::Int] = int_node;
 
         //Nothing Class
-        ClassNode nothing_node = ClassNode("Nothing", "Obj");
-        nothing_node.constructor_.return_type = "Nothing";
-        class_hierarchy["Nothing"] = nothing_node;
+        ClassNode nothing_node = ClassNode(sym::Nothing, sym::Obj);
+        nothing_node.constructor_.return_type = types::Nothing;
+        class_hierarchy[sym::Nothing] = nothing_node;
 
         // now go through the class_hierarchy again and check for cycles and nonexistent parents
         std::cout << "SORTING " << class_hierarchy.size() << " CLASSES\n" << std::flush;
-        for (std::pair<std::string, ClassNode> element : class_hierarchy) {
-            ClassNode *cn = &class_hierarchy[element.first];
+        for (std::pair<const Symbol, ClassNode> &element : class_hierarchy) {
+            ClassNode *cn = &element.second;
             //std::cout << "***** PRINTING OUT THE MAP: " << element.first << " node name " << element.second.name_
             //          << " with parent " << element.second.parent_ << endl;
             topologicalSortRec(cn);
         }
+        assign_type_ids();
+        build_hierarchy_index();
+
+        // Now that types have IDs, populate the user classes
+        for (AST::Class *clazz: class_list) {
+            ClassNode *new_class = &class_hierarchy[clazz->name_.sym_];
+            // populate all the things!
+            //AST::ASTNode *constr = &(clazz->constructor_);
+            AST::Method *constr = &(clazz->constructor_);
+            //AST::Method *construct = (AST::Method *) constr;
+            MethodNode constructor = MethodNode(constr, this);
+            new_class->constructor_ = constructor;
+            new_class->instance_vars = new_class->constructor_.local_vars; //constructors variables are the class level - need this?
+            new_class->add_method(&constructor);
+        }
 
         //ADD any methods - INHERITED FIRST
-        for (int i = 0; i < sorted_classes.size(); i++) {
-            std::cout << (sorted_classes.at(i)).name_ << "\n ";
-            ClassNode* cur_class = &(class_hierarchy[(sorted_classes.at(i).name_)]);
-            if (cur_class->parent_ != "None") {
+        for (ClassNode* cur_class : sorted_classes) {
+            std::cout << cur_class->name_ << "\n ";
+            if (cur_class->parent_ != sym::None) {
                 ClassNode* par_node = &(class_hierarchy[cur_class->parent_]);
-                std::map<string, MethodNode>* parentmethods = &(par_node->methods);
-                for (std::pair<string, MethodNode> element: par_node->methods) {
+                std::map<Symbol, MethodNode>* parentmethods = &(par_node->methods);
+                for (const std::pair<const Symbol, MethodNode> &element: par_node->methods) {
                     std::cout << "ADDING INHERITED METHOD " << element.first << endl;
                     MethodNode new_node = MethodNode();
                     new_node.name = element.second.name;
                     new_node.return_type = element.second.return_type;
                     new_node.inherited_from = element.first;
-                    new_node.local_vars = std::map<string, string>(element.second.local_vars);
+                    new_node.local_vars = std::map<Symbol, TypeId>(element.second.local_vars);
                 }
             }
         }
-//        AST::Classes classes = root_node->classes_;
-//        vector<AST::Class *> class_list = classes.elements_;
         for (AST::Class *clazz: class_list) {
-            std::cout << "Creating extra methods for class: " << clazz->name_.text_ << endl;
-            vector < AST::Method * > method_list = clazz->methods_.elements_;
-            for (AST::Method *method: method_list) {
-                MethodNode new_method = MethodNode(method);
-                (class_hierarchy[clazz->name_.text_]).add_method(&new_method);
+            std::cout << "Creating extra methods for class: " << clazz->name_.sym_ << endl;
+            for (AST::Method *method: clazz->methods_) {
+                MethodNode new_method = MethodNode(method, this);
+                (class_hierarchy[clazz->name_.sym_]).add_method(&new_method);
                 std::cout << "Created method node with name: " << new_method.name << endl;
             }
         }
@@ -313,28 +416,29 @@ public:
 
     void check_init(AST::ASTNode *root) {
         AST::Program *root_node = (AST::Program*) root;
-        set<string>  initial_vars;
-        initial_vars.insert("Nothing");
-        initial_vars.insert("none");
-        initial_vars.insert("true");
-        initial_vars.insert("false");
-        initial_vars.insert("True");
-        initial_vars.insert("False");
-        initial_vars.insert("Int");
-        initial_vars.insert("Boolean");
-        initial_vars.insert("String");
-        initial_vars.insert("Obj");
-        initial_vars.insert("this");
-        initial_vars.insert("PLUS");
-        initial_vars.insert("MINUS");
-        initial_vars.insert("TIMES");
-        initial_vars.insert("DIVIDE");
-        initial_vars.insert("PRINT");
-        initial_vars.insert("EQUALS");
-        initial_vars.insert("ATMOST");
-        initial_vars.insert("<");
-        initial_vars.insert("ATLEAST");
-        initial_vars.insert(">");
+        ScopedSet initial_vars;
+        initial_vars.insert(sym::Nothing);
+        initial_vars.insert(sym::none);
+        initial_vars.insert(sym::true_);
+        initial_vars.insert(sym::false_);
+        initial_vars.insert(sym::True);
+        initial_vars.insert(sym::False);
+        initial_vars.insert(sym::Int);
+        initial_vars.insert(sym::Boolean);
+        initial_vars.insert(sym::String);
+        initial_vars.insert(sym::Obj);
+        initial_vars.insert(sym::this_);
+        initial_vars.insert(sym::PLUS);
+        initial_vars.insert(sym::MINUS);
+        initial_vars.insert(sym::TIMES);
+        initial_vars.insert(sym::DIVIDE);
+        initial_vars.insert(sym::PRINT);
+        initial_vars.insert(sym::STR);
+        initial_vars.insert(sym::EQUALS);
+        initial_vars.insert(sym::ATMOST);
+        initial_vars.insert(sym::LESS);
+        initial_vars.insert(sym::ATLEAST);
+        initial_vars.insert(sym::MORE);
 
         int success = root_node->init_check(this, &initial_vars);
         if (success) {
@@ -345,68 +449,553 @@ public:
         }
     }
 
-    // do type inference per method!!! can reuse this method with statements after class definitions
+    /* Type inference with a worklist instead of re-checking the whole
+     * program until nothing changes.  Each constructor, method and the
+     * main program is a unit; a unit is checked again only when its own
+     * variables widened, or when the instance variables of a class it
+     * reads (through a Dot) widened.  Types only ever move up the
+     * hierarchy, so this stops.
+     *
+     * The units waiting on the worklist form a round and are checked in
+     * parallel on a thread pool.  A round only reads the tables as the
+     * previous rounds left them; the results are merged afterwards in
+     * the order the units were queued, so the messages and the types we
+     * end up with are the same for any number of threads.
+     *
+     * A method needs the instance variables of its class, and the main
+     * program needs those of every class, so the units start in stages:
+     * all constructors, then all methods once the constructors have
+     * settled, then the main program.
+     */
     void type_inference(AST::ASTNode *root) {
 
         AST::Program *root_node = (AST::Program*) root;
+        build_infer_units(root_node);
+        WorkStealingPool pool(threads);
+        int runs = 0;
+        int rounds = 0;
+        for (int stage = 0; stage < 3; stage++) {
+            for (int i = 0; i < (int) units.size(); i++) {
+                if (units[i].stage == stage) {
+                    enqueue(i);
+                }
+            }
+            while (!worklist.empty()) {
+                vector<int> batch(worklist.begin(), worklist.end());
+                worklist.clear();
+                vector<std::function<void()> > tasks;
+                for (int unit : batch) {
+                    units[unit].queued = false;
+                    tasks.push_back([this, unit] { run_unit(unit); });
+                }
+                pool.run_all(tasks);
+                rounds++;
+                runs += (int) batch.size();
+                for (int unit : batch) {
+                    if (!merge_unit(unit)) {
+                        error = true; //something went wrong
+                        worklist.clear();
+                        return;
+                    }
+                }
+            }
+        }
+        std::cout << "Success with type inference! (" << runs << " checks of "
+                  << units.size() << " units in " << rounds << " rounds, "
+                  << pool.size() << " threads)" << endl;
+    }
+
+    // one unit per constructor and method, in class order, then the main program
+    void build_infer_units(AST::Program *program) {
+        units.clear();
+        field_readers.clear();
+        for (AST::Class *clazz : program->classes_.elements_) {
+            InferUnit ctor;
+            ctor.clazz = clazz;
+            ctor.class_name = clazz->name_.sym_;
+            ctor.method_name = clazz->name_.sym_;
+            units.push_back(ctor);
+            ClassNode *cn = &class_hierarchy[ctor.class_name];
+            for (AST::Method *method : clazz->methods_.elements_) {
+                InferUnit meth;
+                meth.clazz = clazz;
+                meth.method = method;
+                meth.class_name = ctor.class_name;
+                meth.method_name = method->name_.sym_;
+                meth.context = cn->methods[meth.method_name].local_vars;
+                meth.stage = 1;
+                // a method sees the instance variables of its own class
+                field_readers[cn->id_].insert((int) units.size());
+                units.push_back(meth);
+            }
+        }
+        InferUnit main_unit;
+        main_unit.program = program;
+        main_unit.class_name = sym::main_class;
+        main_unit.method_name = sym::main_method;
+        main_unit.context = var_types;
+        main_unit.stage = 2;
+        units.push_back(main_unit);
+    }
+
+    void enqueue(int unit) {
+        if (!units[unit].queued) {
+            units[unit].queued = true;
+            worklist.push_back(unit);
+        }
+    }
 
-        while (changed) { // initialized as true
-            changed = false;
-            std::string result = root_node->type_infer(this, &var_types, "", "");
-            if (result == "Ok") {
-                std::cout << "Success with type inference!"<<endl;
+    // called while checking a Dot: the current unit depends on the fields of this class
+    void note_field_read(TypeId clazz) {
+        InferUnit *u = checking_unit();
+        if (u != nullptr) {
+            u->reads.insert(clazz);
+        }
+    }
+
+    /* called when an assignment widens an instance variable of some
+     * other object (not a constructor's own); the class's field types
+     * take it when the unit is merged
+     */
+    void note_field_write(TypeId clazz, Symbol field, TypeId type) {
+        InferUnit *u = checking_unit();
+        if (u != nullptr) {
+            map<Symbol, TypeId> &fields = u->field_writes[clazz];
+            auto found = fields.find(field);
+            if (found == fields.end()) {
+                fields.insert(std::make_pair(field, type));
             } else {
-                error = true; //something went wrong
+                found->second = lca(found->second, type);
             }
         }
+    }
 
-        // do this to the methods within a class, topologically because of instance variables
-        // make sure not doing anything that doesn't fit that type of instance variables - also trying to do something wrong just within the method
-        //type inference for a method gets a block of statements, with list of local variables
-        // everything starts at bottom - did anything change? pseudo code
-        // pass a context that holds variables, and a flag to say if changed or not
-        // add to the context as things change (recursive walk of the tree)
-        // create a pseudo class (maybe) type inference can be done on a fake class or not, method inference with no context, no instance variables
+    // called when an assignment widened the type of a variable
+    void note_changed() {
+        InferUnit *u = checking_unit();
+        if (u != nullptr) {
+            u->changed = true;
+        }
+    }
 
+    // where type inference messages go: the current unit's log, if there is one
+    std::ostream &log() {
+        InferUnit *u = checking_unit();
+        if (u != nullptr && u->log != nullptr) {
+            return *u->log;
+        }
+        return std::cout;
     }
 
-    // return the least common ancestor of the two classes
-    string lca(string type1, string type2) {
-        if ((type1 == "Top") or (type2 == "Top")) {
-            return "Top";
+    // the instance variables of a class as the current unit should see them
+    map<Symbol, TypeId> *fields_of(ClassNode *cn) {
+        InferUnit *u = checking_unit();
+        if (constructing(cn)) {
+            return &u->fields; // the constructor, working on its own copy
         }
-        // find these two classes on the class hierarchy table and return the lca
-        // if error, return Top
-        if (type1 == type2) {
-            return type1;
+        return &cn->instance_vars;
+    }
+
+    // whether the current unit is the constructor of this class
+    bool constructing(const ClassNode *cn) {
+        InferUnit *u = checking_unit();
+        return u != nullptr && u->clazz != nullptr && u->method == nullptr && u->class_name == cn->name_;
+    }
+
+    /* The type of the instance variable 'field' ("this.x") of an object
+     * of class cn: from cn, or else the nearest superclass that has it.
+     * The current unit depends on the fields of each class it looked in.
+     * nullptr if there is no such instance variable; else the class that
+     * has it goes in 'owner'.
+     */
+    const TypeId *field_type(ClassNode *cn, Symbol field, TypeId *owner = nullptr) {
+        while (cn != nullptr) {
+            note_field_read(cn->id_);
+            map<Symbol, TypeId> *fields = fields_of(cn);
+            auto found = fields->find(field);
+            if (found != fields->end()) {
+                if (owner != nullptr) {
+                    *owner = cn->id_;
+                }
+                return &found->second;
+            }
+            auto parent = class_hierarchy.find(cn->parent_);
+            cn = parent == class_hierarchy.end() ? nullptr : &parent->second;
+        }
+        return nullptr;
+    }
+
+    // lookups that never add to the tables, so they are safe from any thread
+    const ClassNode *find_class(Symbol name) const {
+        auto found = class_hierarchy.find(name);
+        return found == class_hierarchy.end() ? nullptr : &found->second;
+    }
+
+    // the method in the class or else the nearest superclass that has one
+    const MethodNode *find_method(Symbol clazz, Symbol method) const {
+        for (const ClassNode *cn = find_class(clazz); cn != nullptr; cn = find_class(cn->parent_)) {
+            auto found = cn->methods.find(method);
+            if (found != cn->methods.end()) {
+                return &found->second;
+            }
+        }
+        return nullptr;
+    }
+
+    // check one unit; runs on a pool thread, so it must only write to the unit itself
+    void run_unit(int unit) {
+        InferUnit &u = units[unit];
+        std::ostringstream log_stream;
+        u.log = &log_stream;
+        u.changed = false;
+        u.reads.clear();
+        u.field_writes.clear();
+        checking_unit() = &u;
+        auto join = [this](TypeId a, TypeId b) { return lca(a, b); };
+        if (u.program != nullptr) {
+            log() << "About to check the main program" << endl;
+            TypeEnv env(&u.context, &u.all_scopes, join);
+            u.result = u.program->type_infer_statements(this, &env);
+        } else if (u.method == nullptr) {
+            u.fields = class_hierarchy.find(u.class_name)->second.instance_vars;
+            TypeEnv env(&u.fields, &u.all_scopes, join);
+            u.result = u.clazz->type_infer_constructor(this, &env);
         } else {
-            ClassNode cn1 = class_hierarchy[type1];
-            ClassNode cn2 = class_hierarchy[type2];
-            string t1 = cn1.parent_;
-            string t2 = cn2.parent_;
-            vector<string> parents1 = vector<string>();
-            vector<string> parents2 = vector<string>();
-            // get the parents in order and populate the lists
-            for (ClassNode cls : sorted_classes) {
-                string cls_name = cls.name_;
-                if (cls_name == t1) {
-                    parents1.push_back(cls_name);
-                    t1 = cls_name;
+            const ClassNode *cn = find_class(u.class_name);
+            // bring in the instance variables as the constructor left them
+            for (const std::pair<const Symbol, TypeId> &field : cn->instance_vars) {
+                auto found = u.context.find(field.first);
+                if (found == u.context.end()) {
+                    u.context.insert(field);
+                } else {
+                    found->second = lca(found->second, field.second);
+                }
+            }
+            log() << "About to check method: "<<u.method_name<<endl;
+            TypeEnv env(&u.context, &u.all_scopes, join);
+            u.result = u.method->type_infer(this, &env, u.class_name, u.method_name);
+        }
+        checking_unit() = nullptr;
+        u.log = nullptr;
+        u.log_text = log_stream.str();
+    }
+
+    // fold the results of one unit back into the tables; false if it found a type error
+    bool merge_unit(int unit) {
+        InferUnit &u = units[unit];
+        std::cout << u.log_text;
+        u.log_text.clear();
+        if (u.result == types::Top) {
+            if (u.program == nullptr && u.method == nullptr) {
+                std::cout<< "Type Error in Constructor" << endl;
+            }
+            return false;
+        }
+        for (TypeId clazz : u.reads) {
+            field_readers[clazz].insert(unit);
+        }
+        if (u.program != nullptr) {
+            var_types = u.context;
+        } else if (u.method == nullptr) {
+            ClassNode *cn = &class_hierarchy[u.class_name];
+            if (cn->instance_vars != u.fields) {
+                cn->instance_vars = u.fields;
+                for (int reader : field_readers[cn->id_]) {
+                    enqueue(reader);
                 }
-                if (cls_name == t2) {
-                    parents2.push_back(cls_name);
-                    t2 = cls_name;
+            }
+        }
+        // fields of other objects it set, from any unit
+        for (const std::pair<const TypeId, map<Symbol, TypeId>> &written : u.field_writes) {
+            ClassNode *cn = class_node(written.first);
+            bool widened = false;
+            for (const std::pair<const Symbol, TypeId> &field : written.second) {
+                TypeId &type = cn->instance_vars[field.first];
+                TypeId joined = lca(type, field.second);
+                widened = widened || joined != type;
+                type = joined;
+            }
+            if (widened) {
+                for (int reader : field_readers[cn->id_]) {
+                    enqueue(reader);
                 }
             }
-            // now just return the first match between the two lists, if no match...?
-            for (string p : parents1) {
-                for (string pp : parents2) {
-                    if (p == pp) {
-                        return p;
+        }
+        if (u.changed) {
+            enqueue(unit); // widened its own variables, so look again
+        }
+        return true;
+    }
+
+    /* Method tables and objects of the built-in classes, slot by slot
+     * as they are in Builtins.h.  Change the two together.
+     */
+    void builtin_layouts() {
+        ClassLayout *obj = &layouts[types::Obj];
+        obj->add_slot(sym::Obj, "new_Obj", 0);
+        obj->add_slot(sym::STR, "Obj_method_STRING", 0);
+        obj->add_slot(sym::PRINT, "Obj_method_PRINT", 0);
+        obj->add_slot(sym::EQUALS, "Obj_method_EQUALS", 1);
+
+        ClassLayout *str = &layouts[types::String];
+        str->add_slot(sym::String, "new_String", 0);
+        str->add_slot(sym::STR, "String_method_STRING", 0);
+        str->add_slot(sym::PRINT, "String_method_PRINT", 0);
+        str->add_slot(sym::EQUALS, "String_method_EQUALS", 1);
+        str->add_slot(sym::LESS, "String_method_LESS", 1);
+        str->add_slot(sym::PLUS, "String_method_PLUS", 1);
+
+        ClassLayout *boolean = &layouts[types::Boolean];
+        boolean->add_slot(sym::Boolean, "new_Boolean", 0);
+        boolean->add_slot(sym::STR, "Boolean_method_STRING", 0);
+        boolean->add_slot(sym::PRINT, "Obj_method_PRINT", 0);
+        boolean->add_slot(sym::EQUALS, "Obj_method_EQUALS", 1);
+
+        ClassLayout *nothing = &layouts[types::Nothing];
+        nothing->add_slot(sym::Nothing, "new_Nothing", 0);
+        nothing->add_slot(sym::STR, "Nothing_method_STRING", 0);
+        nothing->add_slot(sym::PRINT, "Obj_method_PRINT", 0);
+        nothing->add_slot(sym::EQUALS, "Obj_method_EQUALS", 1);
+
+        ClassLayout *integer = &layouts[types::Int];
+        integer->add_slot(sym::Int, "new_Int", 0);
+        integer->add_slot(sym::STR, "Int_method_STRING", 0);
+        integer->add_slot(sym::PRINT, "Int_method_PRINT", 0);
+        integer->add_slot(sym::EQUALS, "Int_method_EQUALS", 1);
+        integer->add_slot(sym::LESS, "Int_method_LESS", 1);
+        integer->add_slot(sym::PLUS, "Int_method_PLUS", 1);
+        integer->add_slot(sym::MINUS, "Int_method_MINUS", 1);
+        integer->add_slot(sym::TIMES, "Int_method_TIMES", 1);
+        integer->add_slot(sym::DIVIDE, "Int_method_DIVIDE", 1);
+        integer->add_slot(sym::MORE, "Int_method_MORE", 1);
+        integer->add_slot(sym::ATLEAST, "Int_method_ATLEAST", 1);
+        integer->add_slot(sym::ATMOST, "Int_method_ATMOST", 1);
+    }
+
+    /* Lay out the method table and the instance variables of every user
+     * class.  sorted_classes has superclasses first, so each class starts
+     * from a copy of its superclass's finished layout, overrides the
+     * slots of methods it redefines and appends the ones it introduces.
+     */
+    void build_layouts(AST::ASTNode *root) {
+        AST::Program *root_node = (AST::Program*) root;
+        layouts = vector<ClassLayout>(type_names.size());
+        for (TypeId id = types::Nothing; id < types::FIRST_USER_CLASS; id++) {
+            layouts[id].name = type_names[id];
+            layouts[id].builtin = true;
+        }
+        builtin_layouts();
+        map<Symbol, AST::Class *> class_asts;
+        for (AST::Class *clazz : root_node->classes_) {
+            class_asts[clazz->name_.sym_] = clazz;
+        }
+        for (ClassNode *cn : sorted_classes) {
+            if (cn->id_ < types::FIRST_USER_CLASS) {
+                continue;
+            }
+            AST::Class *clazz = class_asts[cn->name_];
+            ClassLayout &layout = layouts[cn->id_];
+            layout = layouts[cn->parent_id_];
+            layout.name = cn->name_;
+            layout.builtin = false;
+            std::string cname = cn->name_.str();
+            layout.slots[0] = VtableSlot{cn->name_, "new_" + cname, (int) clazz->constructor_.formals_.size()};
+            layout.slot_of.erase(layouts[cn->parent_id_].slots[0].method);
+            layout.slot_of[cn->name_] = 0;
+            for (AST::Method *method : clazz->methods_) {
+                layout.add_slot(method->name_.sym_, cname + "_method_" + method->name_.sym_.str(),
+                                (int) method->formals_.size());
+            }
+            // instance variables are the "this.x" entries the constructor set, on any path
+            set<Symbol> inherited(layout.fields.begin(), layout.fields.end());
+            const std::string prefix = "this.";
+            for (const std::pair<const Symbol, TypeId> &var : *variables_of(clazz, nullptr)) {
+                const std::string &text = var.first.str();
+                if (text.compare(0, prefix.size(), prefix) == 0) {
+                    Symbol field = Symbol::intern(text.substr(prefix.size()));
+                    if (!inherited.count(field)) {
+                        layout.fields.push_back(field);
                     }
                 }
             }
         }
-        return "Top"; // nothing matched some sort of error
     }
-};
\ No newline at end of file
+
+    // true if sub is super or one of its subclasses
+    bool is_subclass(TypeId sub, TypeId super) {
+        return lca(sub, super) == super;
+    }
+
+    /* The static types of the variables of a constructor (method == nullptr),
+     * a method, or the main program (clazz == nullptr), as type inference
+     * left them: each joined over every scope it had a type in, since a
+     * variable first set inside an if or a while is still one C variable.
+     */
+    const map<Symbol, TypeId> *variables_of(AST::Class *clazz, AST::Method *method) {
+        for (InferUnit &u : units) {
+            if (u.clazz == clazz && u.method == method) {
+                return &u.all_scopes;
+            }
+        }
+        return nullptr;
+    }
+
+    // every class an object of static type 'clazz' can belong to (the hierarchy is closed)
+    vector<TypeId> subclasses(TypeId clazz) {
+        vector<TypeId> found;
+        for (TypeId sub = types::Nothing; sub < (TypeId) layouts.size(); sub++) {
+            if (is_subclass(sub, clazz)) {
+                found.push_back(sub);
+            }
+        }
+        return found;
+    }
+
+    /* Number the classes: the built-in classes keep their reserved
+     * IDs, user classes are numbered in topological order, so a
+     * user class always has a larger ID than its superclass.
+     */
+    void assign_type_ids() {
+        type_names = vector<Symbol>(types::FIRST_USER_CLASS, sym::EMPTY);
+        type_names[types::Top] = sym::Top;
+        type_names[types::Nothing] = sym::Nothing;
+        type_names[types::Obj] = sym::Obj;
+        type_names[types::Int] = sym::Int;
+        type_names[types::String] = sym::String;
+        type_names[types::Boolean] = sym::Boolean;
+        for (ClassNode *cls : sorted_classes) {
+            Symbol name = cls->name_;
+            if (name == sym::Nothing || name == sym::Obj || name == sym::Int
+                || name == sym::String || name == sym::Boolean) {
+                continue;
+            }
+            type_names.push_back(name);
+        }
+        classes_by_id = vector<ClassNode*>(type_names.size(), nullptr);
+        for (TypeId id = types::Nothing; id < (TypeId) type_names.size(); id++) {
+            ClassNode *cn = &class_hierarchy[type_names[id]];
+            cn->id_ = id;
+            classes_by_id[id] = cn;
+        }
+        for (TypeId id = types::Nothing; id < (TypeId) type_names.size(); id++) {
+            ClassNode *cn = classes_by_id[id];
+            if (cn->parent_ != sym::None) {
+                cn->parent_id_ = class_hierarchy[cn->parent_].id_;
+            }
+        }
+    }
+
+    // the class ID for a type name; "none" is Nothing and anything we don't know is Top
+    TypeId type_id(Symbol name) {
+        if (name == sym::none) {
+            return types::Nothing;
+        }
+        auto found = class_hierarchy.find(name);
+        if (found == class_hierarchy.end()) {
+            return types::Top;
+        }
+        return found->second.id_;
+    }
+
+    // the name of a type, for messages
+    Symbol type_name(TypeId type) {
+        if (type == types::Ok) {
+            return sym::Ok;
+        }
+        if (type == types::Unset) {
+            return sym::EMPTY;
+        }
+        return type_names[type];
+    }
+
+    // the class node for a class ID, or nullptr if it isn't a class
+    ClassNode* class_node(TypeId type) {
+        if (!types::is_class(type) || type >= (TypeId) classes_by_id.size()) {
+            return nullptr;
+        }
+        return classes_by_id[type];
+    }
+
+    /* Index the hierarchy for constant-time ancestor jumps (binary
+     * lifting): ancestor_[k * n + c] is the 2^k-th superclass of class c,
+     * with Top standing above Obj.  Built once, right after sorting,
+     * so that lca never has to walk the class list.
+     */
+    void build_hierarchy_index() {
+        int n = (int) type_names.size();
+        depth_ = vector<int>(n, 0);
+        // sorted order visits superclasses before their subclasses
+        for (ClassNode *cn : sorted_classes) {
+            if (cn->parent_id_ != types::Top) {
+                depth_[cn->id_] = depth_[cn->parent_id_] + 1;
+            }
+        }
+        int max_depth = 0;
+        for (int d : depth_) {
+            max_depth = std::max(max_depth, d);
+        }
+        lift_levels_ = 1;
+        while ((1 << lift_levels_) <= max_depth) {
+            lift_levels_++;
+        }
+        ancestor_ = vector<TypeId>(lift_levels_ * n, types::Top);
+        for (TypeId id = types::Nothing; id < n; id++) {
+            ancestor_[id] = classes_by_id[id]->parent_id_;
+        }
+        for (int k = 1; k < lift_levels_; k++) {
+            for (TypeId id = 0; id < n; id++) {
+                ancestor_[k * n + id] = ancestor_[(k - 1) * n + ancestor_[(k - 1) * n + id]];
+            }
+        }
+    }
+
+    // return the least common ancestor of the two classes
+    TypeId lca(TypeId type1, TypeId type2) {
+        if ((type1 == types::Top) or (type2 == types::Top)) {
+            return types::Top;
+        }
+        if (type1 == type2) {
+            return type1;
+        }
+        if (!types::is_class(type1) or !types::is_class(type2)) {
+            return types::Top; // not something we can join
+        }
+        int n = (int) type_names.size();
+        // lift the deeper class to the depth of the other
+        if (depth_[type1] < depth_[type2]) {
+            std::swap(type1, type2);
+        }
+        int diff = depth_[type1] - depth_[type2];
+        for (int k = 0; diff != 0; k++, diff >>= 1) {
+            if (diff & 1) {
+                type1 = ancestor_[k * n + type1];
+            }
+        }
+        if (type1 == type2) {
+            return type1;
+        }
+        // then climb together, as far as they still differ
+        for (int k = lift_levels_ - 1; k >= 0; k--) {
+            if (ancestor_[k * n + type1] != ancestor_[k * n + type2]) {
+                type1 = ancestor_[k * n + type1];
+                type2 = ancestor_[k * n + type2];
+            }
+        }
+        return ancestor_[type1]; // Top if nothing matched, some sort of error
+    }
+};
+
+inline MethodNode::MethodNode(AST::Method *method, StaticSemantics *ss) {
+    name = method->name_.sym_;
+
+    return_type = ss->type_id(method->returns_.get_sym());
+    local_vars = map<Symbol, TypeId>();
+    local_vars[sym::True] = types::Boolean;
+    local_vars[sym::False] = types::Boolean;
+    local_vars[sym::true_] = types::Boolean;
+    local_vars[sym::false_] = types::Boolean;
+
+    for (AST::Formal *formal: method->formals_) {
+        local_vars[formal->var_.sym_] = ss->type_id(formal->type_.sym_);
+    }
+}